@@ -1,23 +1,75 @@
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Description:  A program that parses a number of phrases input as command    *
- * line arguments. Each phrase can be a basic type of variable or a legitimate *
- * complex type (array, function or pointer).                                  *
- * Complex types may be compounded and may refer to other phrases by variable  *
- * names, each ending in a basic type.                                         *
- * A first pass through the phrases is made to establish the type, length and  *
- * any variable named in each phrase as well as to fully process basic         *
- * phrases. The second pass processes complex phrases including continuations  *
- * and references between phrase types.                                        *
+ * line arguments, or read from a file (standard input if the file is "-")     *
+ * given with the option -f. Each phrase can be a basic type of variable or a  *
+ * legitimate complex type (array, function or pointer). Complex types may be  *
+ * compounded and may refer to other phrases by variable names, each ending in *
+ * a basic type. A first pass through the phrases is made to establish the     *
+ * type, length and any variable named in each phrase as well as to fully      *
+ * process basic phrases. The second pass processes complex phrases, walking a *
+ * table of the transitions of their grammar over the keywords, up to any      *
+ * reference to another phrase.                                                *
+ *                                                                             *
+ * Each phrase is parsed into a tree of declarators, which are allocated from  *
+ * an arena and freed together. The types of the trees are then interned in a  *
+ * hash-consed table, so that phrases of the same type share one type node and *
+ * the C declaration of each distinct type is written once.                    *
+ *                                                                             *
+ * All the state of the parser is kept in a context, so the parser can also be *
+ * used through the interface in types.h. main is then a command line          *
+ * interface to it.                                                            *
+ * The second pass over large phrase sets, and the writing of their types, is  *
+ * shared by a pool of threads, so compile with -pthread.                      *
+ *                                                                             *
+ * With the option -d, a document of phrases is kept up to date as commands on *
+ * standard input, or from the clients of the Unix socket named after -d, add, *
+ * change and delete its phrases. Only the phrases whose references lead       *
+ * through a changed phrase are checked and written again.                     *
+ *                                                                             *
+ * With the option -b, the file named after it holds a batch of independent    *
+ * phrase sets, separated by lines holding only ---, which are parsed at the   *
+ * same time by a thread for each processor. Each is written out in turn, with *
+ * the same lines between them, as its declarations or as "Incorrect input",   *
+ * without stopping the others.                                                *
+ *                                                                             *
+ * With the option --typedefs, the type of each phrase referred to is written  *
+ * once as a typedef, on a line before the first phrase referring to it, and   *
+ * phrases referring to another are written in terms of its typedef, so the    *
+ * output grows only as the phrases do. It can be used with -f, -b or phrases. *
+ *                                                                             *
+ * Compiled with TYPES_STATS defined, the option --stats reports the time      *
+ * taken by each phase and counts of the work done in it, as tab separated     *
+ * lines on standard error. It can be used with -f or phrases.                 *
+ *                                                                             *
+ * Options can be given in any order, among the phrases or not. Other uses of  *
+ * them are refused with a usage message.                                      *
  *                                                                             *
  * Written by Jake Hoare for COMP9021                                          *
  *                                                                             *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#ifdef TYPES_STATS
+#include <time.h>
+#endif
+
+#include "types.h"
 
 /* type is one of the following ... */
 #define BASIC 0
@@ -25,12 +77,73 @@
 #define POINTER 2
 #define FUNCTION 3
 
+/* kind of declarator is one of the types above or ... */
+#define REFERENCE 4
+
+/* chain colour of a phrase during the loop check is one of the following ... */
+#define UNVISITED 0
+#define ON_PATH 1
+#define RESOLVED 2
+
 /* stage is one of the following ... */
 #define START 1
-#define CONTINUE 2
 #define REFER 3
 #define FINISHED 4
 #define ERROR 5
+#define OUT_OF_MEMORY 6
+
+/* The token of a word of a complex phrase is one of the following ... */
+#define OTHER_WORD 0
+#define ONE 1  // A number of elements of 1.
+#define MANY 2  // A number of elements of more than 1.
+#define FIRST_KEYWORD 3  // The keywords from here on are in the order of keywords[].
+#define A_WORD 3
+#define AN_WORD 4
+#define ARRAY_WORD 5
+#define ARRAYS_WORD 6
+#define POINTER_WORD 7
+#define POINTERS_WORD 8
+#define FUNCTION_WORD 9
+#define FUNCTIONS_WORD 10
+#define DATUM_WORD 11
+#define DATA_WORD 12
+#define OF_WORD 13
+#define TO_WORD 14
+#define RETURNING_WORD 15
+#define TYPE_WORD 16
+#define THE_WORD 17
+#define VOID_WORD 18
+#define NB_TOKENS 19
+
+/* The state of parsing a complex phrase is the last words read, one of the following ... */
+#define AFTER_ARRAY 1
+#define AFTER_ARRAY_OF 2
+#define AFTER_ONE_ELEMENT 3
+#define AFTER_ELEMENTS 4
+#define AFTER_POINTER 5
+#define AFTER_POINTERS 6
+#define AFTER_POINTER_TO 7
+#define AFTER_POINTERS_TO 8
+#define AFTER_POINTER_TO_A 9
+#define AFTER_POINTER_TO_AN 10
+#define AFTER_FUNCTION 11
+#define AFTER_RETURNING 12
+#define AFTER_RETURNING_A 13
+#define AFTER_DATUM 14
+#define AFTER_DATUM_OF 15
+#define AFTER_OF_TYPE 16
+#define AFTER_THE 17
+#define AFTER_THE_TYPE 18
+#define NB_STATES 19
+
+/* The action on reading a word is one of the following, the last three ending the phrase ... */
+#define NO_ACTION 0
+#define ADD_ARRAY 1
+#define ADD_POINTER 2
+#define ADD_FUNCTION 3
+#define END_VOID 4
+#define END_BASIC 5  // The basic type is read from the word to the end of the phrase.
+#define END_REFERENCE 6
 
 /* basic type bit values. */
 #define INT 1
@@ -41,689 +154,2965 @@
 #define UNSIGNED 32
 #define SHORT 64
 #define LONG 128
-#define LONGLONG 256
+#define LONGLONG 256  // Two longs.
+
+/* The C basic type of a combination of basic words is one of the following, or 0 if none ... */
+#define C_CHAR 1
+#define C_SIGNED_CHAR 2
+#define C_UNSIGNED_CHAR 3
+#define C_SHORT 4
+#define C_UNSIGNED_SHORT 5
+#define C_INT 6
+#define C_UNSIGNED 7
+#define C_LONG 8
+#define C_UNSIGNED_LONG 9
+#define C_LONG_LONG 10
+#define C_UNSIGNED_LONG_LONG 11
+#define C_FLOAT 12
+#define C_DOUBLE 13
+#define C_LONG_DOUBLE 14
+#define NB_C_TYPES 15
 
 #define NB_ILLEGAL_VARIABLES 25
-#define MAX_OUTPUT 200
 #define NO_DATA -1
-#define EMPTY_CHAR_BEFORE 99
-#define EMPTY_CHAR_AFTER 100
+#define DECLARED_AGAIN(phrase) (-2 - (phrase))  // Marks a name index entry, and turns it back.
 #define MIN_BASIC 2
 #define MIN_COMPLEX 4
+#define MIN_WORDS 256
+#define MIN_PHRASES 64
+#define CACHE_LINE 64
+#define MIN_OUTPUT 256
+#define OUTPUT_FLUSH 65536
+#define DOCUMENT_DELIMITER "---"
+#define ACCEPT_BACKOFF 1  // Seconds to wait when out of descriptors for a client.
+#define TYPEDEF_PREFIX "type_of_"  // Put before a variable name to name the typedef of its type.
+#define MAX_SUFFIX_LENGTH 16
+#define DECLARATOR_BLOCK 4096
+#define MIN_TYPE_NODES 64
+#define READ_CHUNK 65536
+#define MIN_PARALLEL_ITEMS 4096
+#define PARALLEL_CHUNK 64
+
+/* With TYPES_STATS defined, each phase of parsing is timed and the work done in it is counted,
+ * else these compile to nothing. Each thread counts on its own, and adds its counts to the
+ * context at the end of its share of the work. */
+#ifdef TYPES_STATS
+#define COUNT(counter) (++thread_counts[counter])
+#define COUNT_BY(counter, number) (thread_counts[counter] += (number))
+#define START_STATS(ctx) start_stats(ctx)
+#define END_PHASE(ctx, phase) end_phase(ctx, phase)
+#define ADD_COUNTS(ctx) add_counts(ctx)
+#else
+#define COUNT(counter) ((void) 0)
+#define COUNT_BY(counter, number) ((void) 0)
+#define START_STATS(ctx) ((void) 0)
+#define END_PHASE(ctx, phase) ((void) 0)
+#define ADD_COUNTS(ctx) ((void) 0)
+#endif
+
+/* A word of the input, pointing into the command line arguments or the input buffer.
+ * Words are not null terminated and a final full stop is not part of the word. */
+typedef struct {
+    const char *text;
+    int length;
+} word;
+
+/* A node of the declarator tree of a phrase, from its outermost type in to its basic type.
+ * The tree of a phrase referring to another ends with a REFERENCE node that leads on to the
+ * tree of the referenced phrase, so referenced trees are shared rather than copied. */
+typedef struct declarator {
+    int kind;  // BASIC, ARRAY, POINTER, FUNCTION or REFERENCE.
+    word text;  // The number of elements of an ARRAY or the C name of a BASIC type.
+    struct declarator *next;  // The type that this one is made of, NULL for a BASIC type.
+    int type_id;  // The interned type from this declarator in, NO_DATA until interned.
+} declarator;
+
+/* A type interned in the type table. Types are hash-consed: a type is made of the same kind,
+ * text and next type as another only if it is that type, so types are equal only if their IDs
+ * are. The declaration of a type is written once, with no variable name, for all the phrases
+ * of that type. */
+typedef struct {
+    int kind;  // BASIC, ARRAY, POINTER or FUNCTION.
+    word text;  // As for declarators.
+    int next;  // The ID of the type that this one is made of, NO_DATA for a BASIC type.
+    size_t output;  // Where the declaration starts in type_output, if written.
+    int output_length;  // The length of the declaration, NO_DATA if not written.
+    int name_position;  // Where a variable name goes in the declaration.
+} type_node;
+
+/* Declarators are allocated from blocks in an arena and are all freed in one step when the
+ * next phrase set is parsed, the blocks being kept for reuse. */
+typedef struct declarator_block {
+    struct declarator_block *next;
+    int nb_used;
+    declarator nodes[DECLARATOR_BLOCK];
+} declarator_block;
+
+typedef struct {
+    declarator_block *first;
+    declarator_block *current;  // The block new declarators are taken from.
+} arena;
+
+/* A transition of the grammar of complex phrases, from a state on reading a word: the next state
+ * and the action. A transition to no state (0) without an action is an error. */
+typedef struct {
+    unsigned char next;
+    unsigned char action;
+} transition;
+
+static const char *const keywords[NB_TOKENS - FIRST_KEYWORD] = {"a", "an", "array", "arrays", "pointer", "pointers",
+    "function", "functions", "datum", "data", "of", "to", "returning", "type", "the", "void"};
+
+/* The keyword token of a word by its length and first letter, which are different for each. */
+#define MAX_KEYWORD_LENGTH 9
+static const unsigned char keyword_tokens[MAX_KEYWORD_LENGTH + 1][26] = {
+    [1] = {['a' - 'a'] = A_WORD},
+    [2] = {['a' - 'a'] = AN_WORD, ['o' - 'a'] = OF_WORD, ['t' - 'a'] = TO_WORD},
+    [3] = {['t' - 'a'] = THE_WORD},
+    [4] = {['d' - 'a'] = DATA_WORD, ['t' - 'a'] = TYPE_WORD, ['v' - 'a'] = VOID_WORD},
+    [5] = {['a' - 'a'] = ARRAY_WORD, ['d' - 'a'] = DATUM_WORD},
+    [6] = {['a' - 'a'] = ARRAYS_WORD},
+    [7] = {['p' - 'a'] = POINTER_WORD},
+    [8] = {['f' - 'a'] = FUNCTION_WORD, ['p' - 'a'] = POINTERS_WORD},
+    [9] = {['f' - 'a'] = FUNCTIONS_WORD, ['r' - 'a'] = RETURNING_WORD}};
+
+/* The grammar of complex phrases. Nouns after an array of one element or a singular pointer are
+ * singular, after more elements or plural pointers plural. A singular noun after "to" or
+ * "returning" takes its article. A pointer or function can lead to void, a function returns only a
+ * pointer or a datum, and a datum or data are "of type" a basic type or "the type of" a variable. */
+static const transition grammar[NB_STATES][NB_TOKENS] = {
+    [AFTER_ARRAY] = {[OF_WORD] = {AFTER_ARRAY_OF, NO_ACTION}},
+    [AFTER_ARRAY_OF] = {[ONE] = {AFTER_ONE_ELEMENT, ADD_ARRAY}, [MANY] = {AFTER_ELEMENTS, ADD_ARRAY}},
+    [AFTER_ONE_ELEMENT] = {[DATUM_WORD] = {AFTER_DATUM, NO_ACTION}, [ARRAY_WORD] = {AFTER_ARRAY, NO_ACTION},
+                           [POINTER_WORD] = {AFTER_POINTER, NO_ACTION}},
+    [AFTER_ELEMENTS] = {[DATA_WORD] = {AFTER_DATUM, NO_ACTION}, [ARRAYS_WORD] = {AFTER_ARRAY, NO_ACTION},
+                        [POINTERS_WORD] = {AFTER_POINTERS, NO_ACTION}},
+    [AFTER_POINTER] = {[TO_WORD] = {AFTER_POINTER_TO, ADD_POINTER}},
+    [AFTER_POINTERS] = {[TO_WORD] = {AFTER_POINTERS_TO, ADD_POINTER}},
+    [AFTER_POINTER_TO] = {[VOID_WORD] = {0, END_VOID}, [A_WORD] = {AFTER_POINTER_TO_A, NO_ACTION},
+                          [AN_WORD] = {AFTER_POINTER_TO_AN, NO_ACTION}},
+    [AFTER_POINTERS_TO] = {[VOID_WORD] = {0, END_VOID}, [POINTERS_WORD] = {AFTER_POINTERS, NO_ACTION},
+                           [ARRAYS_WORD] = {AFTER_ARRAY, NO_ACTION}, [FUNCTIONS_WORD] = {AFTER_FUNCTION, NO_ACTION},
+                           [DATA_WORD] = {AFTER_DATUM, NO_ACTION}},
+    [AFTER_POINTER_TO_A] = {[POINTER_WORD] = {AFTER_POINTER, NO_ACTION}, [FUNCTION_WORD] = {AFTER_FUNCTION, NO_ACTION},
+                            [DATUM_WORD] = {AFTER_DATUM, NO_ACTION}},
+    [AFTER_POINTER_TO_AN] = {[ARRAY_WORD] = {AFTER_ARRAY, NO_ACTION}},
+    [AFTER_FUNCTION] = {[RETURNING_WORD] = {AFTER_RETURNING, ADD_FUNCTION}},
+    [AFTER_RETURNING] = {[VOID_WORD] = {0, END_VOID}, [A_WORD] = {AFTER_RETURNING_A, NO_ACTION}},
+    [AFTER_RETURNING_A] = {[POINTER_WORD] = {AFTER_POINTER, NO_ACTION}, [DATUM_WORD] = {AFTER_DATUM, NO_ACTION}},
+    [AFTER_DATUM] = {[OF_WORD] = {AFTER_DATUM_OF, NO_ACTION}},
+    [AFTER_DATUM_OF] = {[TYPE_WORD] = {AFTER_OF_TYPE, NO_ACTION}},
+    [AFTER_OF_TYPE] = {[THE_WORD] = {AFTER_THE, NO_ACTION}},
+    [AFTER_THE] = {[TYPE_WORD] = {AFTER_THE_TYPE, NO_ACTION}},
+    [AFTER_THE_TYPE] = {[OF_WORD] = {0, END_REFERENCE}}};
+
+/* The transition on reading a word for which the grammar has none, else an error. */
+static const transition otherwise[NB_STATES] = {[AFTER_OF_TYPE] = {0, END_BASIC}};
+
+/* The state after the first word of a phrase of each type, and any variable name. */
+static const int first_states[] = {[ARRAY] = AFTER_ARRAY, [POINTER] = AFTER_POINTER, [FUNCTION] = AFTER_FUNCTION};
+
+/* A basic word and its bit value. */
+typedef struct {
+    const char *text;
+    int bit;
+} specifier;
+
+/* The basic words by their length and first letter, which are different for each. */
+#define MAX_SPECIFIER_LENGTH 8
+static const specifier specifiers[MAX_SPECIFIER_LENGTH + 1][26] = {
+    [3] = {['i' - 'a'] = {"int", INT}},
+    [4] = {['c' - 'a'] = {"char", CHAR}, ['l' - 'a'] = {"long", LONG}},
+    [5] = {['f' - 'a'] = {"float", FLOAT}, ['s' - 'a'] = {"short", SHORT}},
+    [6] = {['d' - 'a'] = {"double", DOUBLE}, ['s' - 'a'] = {"signed", SIGNED}},
+    [8] = {['u' - 'a'] = {"unsigned", UNSIGNED}}};
+
+/* The C basic type of each combination of the bits of the basic words of a phrase. int is implied
+ * by the other words of an integer type and signed by all but unsigned. Any combination not
+ * listed, with two of signed and unsigned, two sizes or words of different types, is none. */
+static const unsigned char c_types[2 * LONGLONG] = {
+    [CHAR] = C_CHAR, [SIGNED + CHAR] = C_SIGNED_CHAR, [UNSIGNED + CHAR] = C_UNSIGNED_CHAR,
+    [SHORT] = C_SHORT, [SHORT + INT] = C_SHORT, [SIGNED + SHORT] = C_SHORT, [SIGNED + SHORT + INT] = C_SHORT,
+    [UNSIGNED + SHORT] = C_UNSIGNED_SHORT, [UNSIGNED + SHORT + INT] = C_UNSIGNED_SHORT,
+    [INT] = C_INT, [SIGNED] = C_INT, [SIGNED + INT] = C_INT,
+    [UNSIGNED] = C_UNSIGNED, [UNSIGNED + INT] = C_UNSIGNED,
+    [LONG] = C_LONG, [LONG + INT] = C_LONG, [SIGNED + LONG] = C_LONG, [SIGNED + LONG + INT] = C_LONG,
+    [UNSIGNED + LONG] = C_UNSIGNED_LONG, [UNSIGNED + LONG + INT] = C_UNSIGNED_LONG,
+    [LONGLONG] = C_LONG_LONG, [LONGLONG + INT] = C_LONG_LONG, [SIGNED + LONGLONG] = C_LONG_LONG,
+    [SIGNED + LONGLONG + INT] = C_LONG_LONG,
+    [UNSIGNED + LONGLONG] = C_UNSIGNED_LONG_LONG, [UNSIGNED + LONGLONG + INT] = C_UNSIGNED_LONG_LONG,
+    [FLOAT] = C_FLOAT, [DOUBLE] = C_DOUBLE, [LONG + DOUBLE] = C_LONG_DOUBLE};
+
+/* The C declaration of each C basic type. */
+static const word c_type_outputs[NB_C_TYPES] = {
+    [C_CHAR] = {"char", 4}, [C_SIGNED_CHAR] = {"signed char", 11}, [C_UNSIGNED_CHAR] = {"unsigned char", 13},
+    [C_SHORT] = {"short", 5}, [C_UNSIGNED_SHORT] = {"unsigned short", 14}, [C_INT] = {"int", 3},
+    [C_UNSIGNED] = {"unsigned", 8}, [C_LONG] = {"long", 4}, [C_UNSIGNED_LONG] = {"unsigned long", 13},
+    [C_LONG_LONG] = {"long long", 9}, [C_UNSIGNED_LONG_LONG] = {"unsigned long long", 18},
+    [C_FLOAT] = {"float", 5}, [C_DOUBLE] = {"double", 6}, [C_LONG_DOUBLE] = {"long double", 11}};
+
+static const char *const illegal_variables[NB_ILLEGAL_VARIABLES] = {"a", "an", "to", "array", "pointer", "function", "signed", "unsigned", "int", "char", "double", "float", "long", "short", "void", "datum", "data", "of", "type", "returning", "A", "An", "pointers", "functions", "arrays"};
 
-char *illegal_variables[NB_ILLEGAL_VARIABLES] = {"a", "an", "to", "array", "pointer", "function", "signed", "unsigned", "int", "char", "double", "float", "long", "short", "void", "datum", "data", "of", "type", "returning", "A", "An", "pointers", "functions", "arrays"};
-
-int max_phrase_index = NO_DATA;  // The highest phrase index (i.e. number of phrases - 1).
-int current; // The index in argv of the current word being processed.
-int phrase_nb = 0;  // The index of the current phrase being processed after any reference to another phrase.
-int original_phrase_nb = 0;  // The index of the current phrase being processed before any reference to another phrase.
-
-int *phrase_end; // The argv index of the last word of each phrase.
-int *phrase_start; // The argv index of the first word of each phrase.
-char **var_name; // The variable names (if any).
-char **reference; // The name of a referenced variable.
-int *continuation; // The phrase index of the referenced variable.
-int *stage; // The stage of processing, initially set to START.
-int *type; // The type description of each phrase, initially set to BASIC.
-int *chain; // Used to check for loops in variable name references.
-char **phrase_output; // The text to be displayed.
-int *output_start;  // The first empty character before the text of the output.
-int *output_end;  // The first empty character after the text of the output.
+/* The items of work left to a worker of the pool, from which other workers can steal. */
+typedef struct {
+    pthread_mutex_t lock;
+    int next;  // The next item to process.
+    int end;  // The item after the last one to process.
+} work_range;
+
+/* A job run on each item of work, given the number of the worker running it. */
+typedef void pool_job(types_context *, int, int);
+
+/* A pool of threads for the second pass and for writing the declarations of the types. The
+ * thread calling types_parse_words or types_parse_text is worker 0 and the threads are workers
+ * 1 and up. */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    pthread_t *threads;
+    work_range *ranges;
+    types_context *ctx;  // The context the pool belongs to.
+    pool_job *job;  // The job of the current generation.
+    int nb_workers;  // The number of threads + 1.
+    int nb_started;  // The number of threads that have taken their worker number.
+    int generation;  // Incremented each time there is work for the threads.
+    int nb_busy;  // The number of threads still working.
+    bool quit;
+} thread_pool;
+
+struct types_context {
+    int max_phrase_index;  // The highest phrase index (i.e. number of phrases - 1).
+    types_error error; // The error found in the phrases, if any.
+    int nb_threads; // The number of threads to parse phrases with.
+    thread_pool *pool; // Started when there is enough work for nb_threads.
+
+    word *words; // The words of all phrases, in input order.
+    int nb_words; // The number of words.
+    int words_size; // The number of words allocated.
+    char *phrase_table; // One allocation holding the arrays below indexed by phrase, and name_index.
+    int phrases_size; // The number of phrases allocated in the phrase table, a power of 2.
+
+    int *phrase_end; // The words index of the last word of each phrase.
+    int *phrase_start; // The words index of the first word of each phrase.
+    word *var_name; // The variable names (if any, else with no text).
+    word *reference; // The name of a referenced variable (if any, else with no text).
+    int *continuation; // The phrase index of the referenced variable.
+    int *stage; // The stage of processing, initially set to START.
+    int *type; // The type description of each phrase, initially set to BASIC.
+    int *chain; // The colour of each phrase when checking for loops in variable name references.
+    int *name_index; // Hash table of phrase indices keyed by variable name, NO_DATA when empty.
+                     // A name declared again has the DECLARED_AGAIN entry of its first phrase.
+    int name_index_size; // The number of slots in name_index, a power of 2.
+    declarator **root; // The declarator tree of each phrase.
+    declarator **reference_node; // The REFERENCE node of each phrase referring to another, else NULL.
+    arena *arenas; // The arenas of the declarators, one for each worker of the second pass.
+    int nb_arenas; // The number of arenas.
+    declarator **declarator_stack; // The declarators waiting for their type to be interned.
+    int declarator_stack_size; // The number of declarators allocated in the stack.
+
+    int *type_id; // The ID of the type of each phrase.
+    int *type_phrase; // The first phrase of each distinct type whose declaration is written.
+    type_node *type_nodes; // The interned types, indexed by ID.
+    int nb_type_nodes; // The number of interned types.
+    int type_nodes_size; // The number of type nodes allocated.
+    int *type_index; // Hash table of type IDs keyed by kind, text and next type, NO_DATA when empty.
+    int type_index_size; // The number of slots in type_index, a power of 2.
+    char *type_output; // The declarations of the types of the phrases, one after the other.
+    size_t type_output_length; // The number of characters used in type_output.
+    size_t type_output_size; // The number of characters allocated in type_output.
+    int typedef_suffix; // The number after '_' ending every typedef name, 0 for none.
+    bool write_types; // Whether the declarations of the types are written when parsing.
+#ifdef TYPES_STATS
+    types_stats stats; // The times and counts of the last phrase set parsed.
+    double phase_start; // The time the phase being timed started, in seconds.
+#endif
+};
+
+/* A variable name in a document, with the phrases declaring it and those referring to it. */
+typedef struct {
+    word name;
+    int nb_declarers;
+    int first_declarer; // The head of the list of phrases declaring the variable, else NO_DATA.
+    int first_referrer; // The head of the list of phrases referring to the variable, else NO_DATA.
+} symbol;
+
+/* A phrase of a document, kept by ID. Its words, declarators and type are kept in the context
+ * of the document under the same index. */
+typedef struct {
+    char *text; // The text of the phrase, NULL once deleted.
+    int status; // TYPES_OK, or the error found in the phrase on its own.
+    int declared; // The symbol of the variable named by the phrase, else NO_DATA.
+    int referred; // The symbol of the variable referred to by the phrase, else NO_DATA.
+    int next_declarer; // The other phrases declaring the same variable, else NO_DATA.
+    int previous_declarer;
+    int next_referrer; // The other phrases referring to the same variable, else NO_DATA.
+    int previous_referrer;
+    int visit; // The last walk through the references that visited the phrase.
+    bool unresolved; // Whether the referred variable is not named by exactly one phrase.
+    bool in_loop; // Whether the phrase is in a loop of references.
+} document_phrase;
+
+struct types_document {
+    types_context *ctx; // The parsed phrases, continuation being the phrase each one refers to.
+    document_phrase *phrases; // The phrases by ID.
+    int nb_phrases; // The number of IDs given out, deleted phrases included.
+    int phrases_size; // The number of phrases allocated.
+    int nb_live; // The number of phrases not deleted.
+    symbol *symbols;
+    int nb_symbols;
+    int *symbol_index; // Hash table of symbols keyed by name, NO_DATA when empty.
+    int symbol_index_size; // The number of slots in symbol_index, a power of 2.
+    char **retired; // The texts of changed phrases, freed at the next rebuild.
+    int nb_retired;
+    int retired_size;
+    int *changed; // The phrases whose reference changed in the last change.
+    int nb_changed;
+    int *queue; // The phrases whose types are being forgotten.
+    int walk; // The number of walks through the references so far.
+    int nb_scan_errors; // The number of phrases in error in the first pass.
+    int nb_bad_phrases; // The number of phrases in error in the second pass.
+    int nb_unresolved; // The number of phrases referring to a variable not named by exactly one phrase.
+    int nb_loop_phrases; // The number of phrases in loops of references.
+    int nb_edits; // The number of phrases changed or deleted since the document was last parsed in full.
+};
+
+/* The state of parsing one phrase. Parsing a phrase only writes the entries of that phrase
+ * in the context, so the phrases can be parsed by tasks running at the same time. */
+typedef struct {
+    types_context *ctx;
+    int phrase_nb;  // The index of the phrase being processed.
+    int current; // The index in words of the current word being processed.
+    arena *arena; // The arena of the worker parsing the phrase.
+    declarator **hole; // Where the next declarator of the phrase goes.
+    bool out_of_memory; // Whether a declarator could not be allocated.
+} phrase_task;
+
+#ifdef TYPES_STATS
+static __thread long long thread_counts[TYPES_NB_COUNTS];
+
+/* Functions that time and count the work of parsing. */
+static void start_stats(types_context *);
+static void end_phase(types_context *, int);
+static void add_counts(types_context *);
+static double stats_clock(void);
+#endif
 
 /* Functions that process each type description.  They return the next processing stage. */
-int process_basic(char **);
-int process_array(char **);
-int process_pointer(char **);
-int process_function(char **);
+static int process_basic(phrase_task *);
+static int process_complex(phrase_task *);
+static int take_action(phrase_task *, int);
+
+/* Functions that run the two passes over the phrases. */
+static int parse_phrases(types_context *);
+static int prepare_phrases(types_context *);
+static int first_pass(types_context *);
+static int resolve_references(types_context *);
+static int check_reference_loops(types_context *);
+static int second_pass(types_context *);
+static int scan_phrase(types_context *, int);
+static void parse_complex_phrase(types_context *, int, int);
+static int fail(types_context *, int, int);
+
+/* Functions that share the second pass and the writing of the types between threads. */
+static void run_job(types_context *, pool_job *, int);
+static thread_pool *start_pool(types_context *, int);
+static void stop_pool(thread_pool *);
+static void *pool_thread(void *);
+static void work_on_ranges(types_context *, thread_pool *, int);
+static bool take_work(thread_pool *, int, int *, int *);
+
+/* Functions that split the input into words and phrases. */
+static bool add_word(types_context *, const char *, int);
+static bool append_word(types_context *, const char *, int);
+static bool grow_phrase_table(types_context *, int);
+static void *place_array(char *, size_t *, const void *, size_t, int, int);
+static bool words_from_buffer(types_context *, const char *, size_t);
 
 /* Functions that handle reading the text. */
-bool check_vowel(char);
-bool check_preposition(char *, char *, bool);
-bool ends_with_full_stop(char *);
-bool permitted_variable_name(char *);
-void output_at_front(int, char *);
-void output_at_back(int, char *);
-int first_phrase_type(char *);
-int data_continuation(char **);
-bool inc_current(void);
-bool complex_variable(void);
-void resize_arrays(void);
+static word current_word(phrase_task *);
+static bool word_is(word, const char *);
+static bool same_words(word, word);
+static int word_value(word);
+static bool check_vowel(char);
+static bool check_preposition(word, word);
+static int word_token(word);
+static bool permitted_variable_name(word);
+static int first_phrase_type(word);
+static void *reallocate(void *, size_t, bool *);
+
+/* Functions that build declarator trees and write them out as C declarations. */
+static declarator *add_declarator(phrase_task *, int, word);
+static declarator *new_declarator(arena *);
+static bool reserve_arenas(types_context *, int);
+static void reset_arena(arena *);
+static void free_arena(arena *);
+static void put_char(char *, int, int, char);
+static int put_word(char *, int, int, word);
+static const declarator *measure_declarators(const declarator *, bool, int *, int *);
+static int put_declarators(const declarator *, bool, char *, int, int, int);
+static int write_full_declaration(const types_context *, int, char *, int);
+static int write_own_declaration(const types_context *, int, bool, char *, int);
+static int put_typedef_name(const types_context *, int, char *, int, int);
+static bool choose_typedef_suffix(types_context *);
+static bool is_variable(const types_context *, word);
+
+/* Functions that intern the types of the phrases and write their declarations. */
+static bool intern_phrase_types(types_context *);
+static int intern_declarators(types_context *, declarator *);
+static int intern_type(types_context *, int, word, int);
+static unsigned hash_type(int, word, int);
+static bool grow_type_index(types_context *);
+static void measure_phrase_type(types_context *, int, int);
+static void put_phrase_type(types_context *, int, int);
+static void measure_type(types_context *, const declarator *);
+static void put_type(types_context *, const declarator *);
+static bool reserve_type_output(types_context *, int);
+static bool write_type(types_context *, const declarator *);
+
+/* Functions that keep documents up to date as their phrases change. */
+static bool single_phrase(const char *, size_t);
+static bool grow_document(types_document *, int);
+static int change_phrase(types_document *, int, const char *, size_t);
+static int load_phrase(types_document *, int);
+static void unload_phrase(types_document *, int);
+static void resolve_phrase(types_document *, int);
+static void resolve_referrers(types_document *, int);
+static void break_loop(types_document *, int);
+static void find_document_loops(types_document *);
+static void invalidate_types(types_document *);
+static int rebuild_document(types_document *);
+static int find_symbol(types_document *, word);
+static bool grow_symbol_index(types_document *);
+static void link_phrase(types_document *, int *, int, bool);
+static void unlink_phrase(types_document *, int *, int, bool);
+static bool retire_text(types_document *, char *);
+
+/* Functions that resolve references between phrases. */
+static unsigned hash_name(word);
+static void index_variable_names(types_context *);
+static int find_name_slot(const types_context *, word);
+static int find_variable(types_context *, word);
+static int find_reference_loop(types_context *);
 
 /* Functions that process basic type descriptions. */
-int read_basic_phrase(int, int, char **);
-int basic_word_type(char *);
-int standardise_basic_phrase(int);
-char *make_basic_output(int);
+static int read_basic_phrase(types_context *, int, int);
+static int specifier_bit(word);
+
+#ifndef TYPES_NO_MAIN
+/* Output of the command line interface, kept in memory, or written to standard output whenever it
+ * holds OUTPUT_FLUSH characters. */
+typedef struct {
+    char *text;
+    int length;
+    int size;
+    bool to_stdout;
+} output_buffer;
+
+/* The documents of a batch, parsed by a pool of threads and written out in order. */
+typedef struct {
+    const char **texts;
+    size_t *sizes;
+    int nb_documents;
+    int documents_size; // The number of documents allocated.
+    output_buffer *outputs; // The output of each document, once it is done.
+    int *results; // The result of parsing each document.
+    bool *done;
+    int next; // The next document to parse.
+    bool typedefs; // Whether the documents are written with typedefs.
+    pthread_mutex_t lock;
+    pthread_cond_t document_done;
+} batch;
+
+/* The options given on the command line, and the words of the phrases given with them. */
+typedef struct {
+    bool serve; // -d, with the socket path or NULL.
+    const char *socket_path;
+    const char *batch_file; // -b, else NULL.
+    const char *phrase_file; // -f, else NULL.
+    bool typedefs; // --typedefs
+    bool stats; // --stats
+    int nb_words;
+    char **words;
+} command_line;
+
+/* Functions of the command line interface. */
+static bool read_command_line(int, char **, command_line *);
+static bool read_file(const char *, const char **, size_t *);
+static bool close_file(int, char *);
+static void report_reference_loop(types_context *, int);
+static bool print_declarations(types_context *, bool);
+static bool add_declarations(types_context *, output_buffer *, bool);
+static bool add_line(types_context *, output_buffer *, int, int (*)(const types_context *, int, char *, int));
+static bool add_output(output_buffer *, const char *, int);
+static bool make_room(output_buffer *, int);
+static bool flush_output(output_buffer *);
+static bool write_out(const char *, size_t);
+static int run_batch(const char *, bool);
+static bool split_documents(const char *, size_t, batch *);
+static bool add_document(batch *, const char *, size_t);
+static void *batch_thread(void *);
+static int serve_document(const char *);
+static bool serve_commands(types_document *, FILE *, FILE *);
+static bool run_command(types_document *, char *, FILE *);
+static bool print_document(types_document *, int, FILE *);
+#ifdef TYPES_STATS
+static void report_stats(types_context *, double);
+#endif
 
-    
 int main(int argc, char **argv) {
-    
-    /* Find the number of phrases. */
-    for (int word_nb = 1; word_nb < argc; ++word_nb)
-        if (ends_with_full_stop(*(argv + word_nb)))
-            ++max_phrase_index;
-    resize_arrays();
-    
-    /* Check that we have at least one phrase and that the final phrase ends at the end of argv. */
-    if (max_phrase_index == NO_DATA || !ends_with_full_stop(*(argv + argc - 1))) {
-        printf("Incorrect input\n");
+    command_line options;
+    if (!read_command_line(argc, argv, &options)) {
+        fprintf(stderr, "Usage: %s [--typedefs] [--stats] [-f FILE | PHRASE WORDS]\n"
+                        "       %s [--typedefs] -b FILE\n"
+                        "       %s -d [SOCKET]\n", *argv, *argv, *argv);
         return EXIT_FAILURE;
     }
+#ifndef TYPES_STATS
+    if (options.stats) {
+        fprintf(stderr, "--stats needs types.c compiled with TYPES_STATS defined\n");
+        return EXIT_FAILURE;
+    }
+#endif
     
-    /* Find the endpoints of each phrase and remove their final full stops. */
-    phrase_start[0] = 1;
-    for (int word_nb = 1; word_nb < argc; ++word_nb)
-        if (ends_with_full_stop(*(argv + word_nb))) {
-            *(*(argv + word_nb) + strlen(*(argv + word_nb)) - 1) = '\0';
-            phrase_end[phrase_nb++] = word_nb;
-            if (phrase_nb <= max_phrase_index)
-                phrase_start[phrase_nb] = word_nb + 1;
-        }
-    
-    /* First pass through phrases to find variable names, references and process basic phrases. */
-    for (phrase_nb = 0; phrase_nb <= max_phrase_index; ++phrase_nb) {
-        original_phrase_nb =  phrase_nb;
-        stage[phrase_nb] = START;
-        type[phrase_nb]= BASIC;
-        continuation[phrase_nb] = NO_DATA;
-        current = phrase_start[phrase_nb] + 1;
-        
-        /* Initialise the output array counters. */
-        output_start[phrase_nb] = EMPTY_CHAR_BEFORE;
-        output_end[phrase_nb] = EMPTY_CHAR_AFTER;
-        
-        /* Check that phrase has at least 2 words. */
-        if (phrase_end[phrase_nb] - phrase_start[phrase_nb] < (MIN_BASIC - 1)) {
-            printf("Incorrect input\n");
-            return EXIT_FAILURE;
-        }
-
-        /* Check correct usage of preposition 'A' or 'An'. */
-        if (!check_preposition(*(argv + current - 1), *(argv + current), true)) {
-            printf("Incorrect input\n");
-            return EXIT_FAILURE;
-        }
+    /* Keep a document up to date from commands on standard input or a Unix socket. */
+    if (options.serve)
+        return serve_document(options.socket_path);
     
-        /* Identify complex phrases (array, pointer or function) and process basic phrases. */
-        type[phrase_nb] = first_phrase_type(*(argv + current));
-        if (type[phrase_nb] == BASIC) {
-            stage[phrase_nb] = process_basic(argv);
-            continue;
-        }
-        
-        /* Check that each complex phrase has the minimum length. */
-        if (phrase_end[phrase_nb] - phrase_start[phrase_nb] < (MIN_COMPLEX - 1)) {
-            printf("Incorrect input\n");
-            return EXIT_FAILURE;
-        }
-        
-        /* If the 3rd word of an ARRAY phrase is not 'of', or POINTER is not 'to', or FUNCTION
-         * is not 'returning' then check if the variable name is valid and store it. */
-        ++current;
-        if ((type[phrase_nb] == ARRAY && strcmp(*(argv + current), "of")) ||
-            (type[phrase_nb] == POINTER && strcmp(*(argv + current), "to")) ||
-            (type[phrase_nb] == FUNCTION && strcmp(*(argv + current), "returning"))) {
-            if (!permitted_variable_name(*(argv + current)))
-                stage[phrase_nb] = ERROR;
-            else
-                var_name[phrase_nb] = *(argv + current);
-        }
-
-        /* If the last word of the complex phrase is a permitted variable name then 
-         * it is a referenced variable. */
-        if (permitted_variable_name(*(argv + phrase_end[phrase_nb])))
-            reference[phrase_nb] = *(argv + phrase_end[phrase_nb]);
-    }
+    /* Parse each document of a batch separately. */
+    if (options.batch_file)
+        return run_batch(options.batch_file, options.typedefs);
     
-    /* For each phrase that references another variable ...*/
-    for (phrase_nb = 0; phrase_nb <= max_phrase_index; ++phrase_nb) {
-        int reference_count = 0;
-        /* if the variable names are the same then we have a continuation. */
-        for (int ref_phrase = 0; ref_phrase <= max_phrase_index; ++ref_phrase)
-            if (reference[phrase_nb] && var_name[ref_phrase] && !strcmp(reference[phrase_nb], var_name[ref_phrase])) {
-                ++reference_count;
-                continuation[phrase_nb] = ref_phrase;
-            }
-        /* There can be only one referenced variable per phrase. */
-        if (reference[phrase_nb] && reference_count != 1) {
-            printf("Incorrect input\n");
-            return EXIT_FAILURE;            
-        }
+    types_context *ctx = types_create();
+    if (!ctx) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
     }
+    types_set_threads(ctx, sysconf(_SC_NPROCESSORS_ONLN));
+    types_set_declarations(ctx, !options.typedefs);
     
-    /* Check that variable references do not create a loop. */
-    for (phrase_nb = 0; phrase_nb <= max_phrase_index; ++phrase_nb) {
-        chain[phrase_nb] = 1;
-        int next_variable = continuation[phrase_nb];
-        while (next_variable != NO_DATA) {
-            if (chain[next_variable]) {
-                printf("Incorrect input\n");
-                return EXIT_FAILURE;
-            }
-            else {
-                chain[next_variable] = 1;
-                next_variable = continuation[next_variable];
-            }
-        }
-        for (int ref_phrase = 0; ref_phrase <= max_phrase_index; ++ref_phrase)
-            chain[ref_phrase] = 0;
-    }      
-    
-    /* Second pass through to process the complex phrases. */
-    for (original_phrase_nb = 0; original_phrase_nb <= max_phrase_index; ++original_phrase_nb) {
-        /* phrase_nb is initially original_phrase_nb and will be changed if there is a REFER. */
-        phrase_nb = original_phrase_nb;
-        current = phrase_start[phrase_nb] + 1;
-        
-        while (stage[original_phrase_nb] != FINISHED && stage[original_phrase_nb] != ERROR) {
-            if (type[phrase_nb] == ARRAY)
-                stage[original_phrase_nb] = process_array(argv);
-            else if (type[phrase_nb] == FUNCTION)
-                stage[original_phrase_nb] = process_function(argv);
-            else if (type[phrase_nb] == POINTER)
-                stage[original_phrase_nb] = process_pointer(argv);
-            else
-                stage[original_phrase_nb] = process_basic(argv);
-        }
-        
-        if (stage[original_phrase_nb] == ERROR) {
-            printf("Incorrect input\n");
+    /* Read the phrases from a file or from the command line arguments after the program name. */
+    int result;
+    if (options.phrase_file) {
+        const char *text;
+        size_t size;
+        if (!read_file(options.phrase_file, &text, &size)) {
+            perror(options.phrase_file);
+            types_destroy(ctx);
             return EXIT_FAILURE;
         }
-        /* Reset all types to original - for use in continuation. */
-        for (int ref_phrase = 0; ref_phrase <= max_phrase_index; ++ref_phrase)
-            type[ref_phrase] = first_phrase_type(*(argv + phrase_start[ref_phrase] + 1));
+        result = types_parse_text(ctx, text, size);
     }
+    else
+        result = types_parse_words(ctx, options.nb_words, options.words);
     
-    /* Print out the phrases. */
-    for (int phrase_nb = 0; phrase_nb <= max_phrase_index; ++phrase_nb) {
-        for (int i = output_start[phrase_nb] + 1; i < output_end[phrase_nb]; ++i){
-            putchar(phrase_output[i][phrase_nb]);
-        }
-        putchar('\n');
+    if (result == TYPES_NO_MEMORY)
+        fprintf(stderr, "Out of memory\n");
+    else if (result != TYPES_OK) {
+        if (result == TYPES_REFERENCE_LOOP)
+            report_reference_loop(ctx, types_last_error(ctx).phrase);
+        printf("Incorrect input\n");
+    }
+    if (result != TYPES_OK) {
+#ifdef TYPES_STATS
+        if (options.stats)
+            report_stats(ctx, 0);
+#endif
+        types_destroy(ctx);
+        return EXIT_FAILURE;
     }
     
-    return EXIT_SUCCESS;
+    /* Print out the phrases. */
+#ifdef TYPES_STATS
+    double print_start = stats_clock();
+#endif
+    bool printed = print_declarations(ctx, options.typedefs);
+#ifdef TYPES_STATS
+    if (options.stats && printed)
+        report_stats(ctx, stats_clock() - print_start);
+#endif
+    types_destroy(ctx);
+    return printed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int process_basic(char **argv) {
-    int basic_phrase_type = 0;
-    
-    if (stage[original_phrase_nb] == START) {
-        if (!basic_word_type(*(argv + phrase_end[phrase_nb]))) {
-            if (!permitted_variable_name(*(argv + phrase_end[phrase_nb])))
-                return ERROR;
-            else {
-                /* Add variable name to output string with a preceeding space and store in var_name array.
-                 * Read the rest of basic phrase apart from the variable name and preposition. */
-                output_at_back(phrase_nb, *(argv + phrase_end[phrase_nb]));
-                output_at_front(phrase_nb, " ");
-                var_name[phrase_nb] = *(argv + phrase_end[phrase_nb]);
-                basic_phrase_type = read_basic_phrase(phrase_start[phrase_nb] + 1, phrase_end[phrase_nb] - 1, argv);
-            }
+/* Read the options wherever they are on the command line, moving the other arguments, the words
+ * of the phrases, to the front. The socket path after -d is optional, and is not taken if it
+ * starts with '-'. Returns false if an option is given twice, lacks its file name, or is used
+ * with others it cannot go with. */
+static bool read_command_line(int argc, char **argv, command_line *options) {
+    memset(options, 0, sizeof(*options));
+    options->words = argv + 1;
+    for (int arg = 1; arg < argc; ++arg) {
+        char *option = argv[arg];
+        const char **file = NULL;
+        bool *flag = NULL;
+        if (!strcmp(option, "--typedefs"))
+            flag = &options->typedefs;
+        else if (!strcmp(option, "--stats"))
+            flag = &options->stats;
+        else if (!strcmp(option, "-d")) {
+            flag = &options->serve;
+            if (!options->serve && arg + 1 < argc && *argv[arg + 1] != '-')
+                options->socket_path = argv[++arg];
         }
+        else if (!strcmp(option, "-b"))
+            file = &options->batch_file;
+        else if (!strcmp(option, "-f"))
+            file = &options->phrase_file;
         else
-            /* No named variable so read all of the basic phrase apart from the preposition. */
-            basic_phrase_type = read_basic_phrase(phrase_start[phrase_nb] + 1, phrase_end[phrase_nb], argv);
+            options->words[options->nb_words++] = option;
+        if (flag) {
+            if (*flag)
+                return false;
+            *flag = true;
+        }
+        if (file) {
+            if (*file || arg + 1 == argc)
+                return false;
+            *file = argv[++arg];
+        }
     }
     
-    if (stage[original_phrase_nb] == CONTINUE)
-        /* Read all of the basic phrase.*/
-        basic_phrase_type = read_basic_phrase(current, phrase_end[phrase_nb], argv);
-
-    if (stage[original_phrase_nb] == REFER)
-        /* Ignore the variable at the end of the basic phrase.*/
-        basic_phrase_type = read_basic_phrase(current, phrase_end[phrase_nb] - 1, argv);
- 
-    if (!basic_phrase_type)
-        return ERROR;
-
-    output_at_front(original_phrase_nb, make_basic_output(basic_phrase_type));
-    return FINISHED;
+    /* Phrases come from one place. Documents and batches are not timed, and documents are only
+     * written out in full. */
+    int nb_sources = options->serve + !!options->batch_file + !!options->phrase_file + (options->nb_words > 0);
+    if (nb_sources > 1)
+        return false;
+    if (options->serve && (options->typedefs || options->stats))
+        return false;
+    return !(options->batch_file && options->stats);
 }
 
+/* Write the declaration of each phrase on a line to standard output. */
+static bool print_declarations(types_context *ctx, bool typedefs) {
+    output_buffer output = {.text = NULL, .length = 0, .size = 0, .to_stdout = true};
+    bool ok = add_declarations(ctx, &output, typedefs) && flush_output(&output);
+    free(output.text);
+    return ok;
+}
 
-
-int process_array(char **argv) {        
-    /* Handle the variable name (if any) according to the stage. */
-    if (!complex_variable())
-        return ERROR;
-            
-    /* current must now be 'of'.*/
-    if (strcmp(*(argv + current), "of"))
-        return ERROR;
-
-    if (!inc_current())
-        return ERROR;
-        
-    /* current must now be an integer to be output in square brackets. */
-    int elements = atoi(*(argv + current));
-    if (!elements)
-        return ERROR;
-    /* current can only consist of digits. */
-    for (int i = 0; i < strlen(*(argv + current)); ++i)
-        if (!isdigit(*(*(argv + current) + i)))
-            return ERROR;
-    output_at_back(original_phrase_nb, "[");
-    output_at_back(original_phrase_nb, *(argv + current));
-    output_at_back(original_phrase_nb, "]");
-    
-    if (!inc_current())
-        return ERROR;
-        
-    /* If singular and 'datum' or plural and 'data'. */
-    if ((elements == 1  && !strcmp(*(argv + current), "datum")) ||
-        (elements > 1 && !strcmp(*(argv + current), "data")))
-        return data_continuation(argv);
-    
-    if ((elements == 1  && !strcmp(*(argv + current), "array")) ||
-        (elements > 1 && !strcmp(*(argv + current), "arrays"))) {
-        return CONTINUE;
+/* Add the declaration of each phrase on a line to an output buffer. The declarations are written
+ * one after the other into the buffer, so that large phrase sets take few system calls. With
+ * typedefs, the typedefs of the phrases that a phrase refers to, directly or not, go before it,
+ * the furthest first, unless they have already been written. Returns false after reporting an
+ * error. */
+static bool add_declarations(types_context *ctx, output_buffer *output, bool typedefs) {
+    if (!output->size && !make_room(output, MIN_OUTPUT))
+        return false;
+    int nb_phrases = types_nb_phrases(ctx);
+    bool *defined = NULL;
+    int *referred = NULL;
+    if (typedefs && nb_phrases) {
+        defined = (bool *) calloc(nb_phrases, sizeof(bool));
+        referred = (int *) malloc(nb_phrases * sizeof(int));
+        if (!defined || !referred) {
+            free(defined);
+            free(referred);
+            fprintf(stderr, "Out of memory\n");
+            return false;
+        }
     }
-    
-    if ((elements == 1  && !strcmp(*(argv + current), "pointer")) ||
-        (elements > 1 && !strcmp(*(argv + current), "pointers"))) {
-        type[phrase_nb] = POINTER;
-        return CONTINUE;
+    bool ok = true;
+    for (int phrase_nb = 0; ok && phrase_nb < nb_phrases; ++phrase_nb) {
+        if (!typedefs) {
+            ok = add_line(ctx, output, phrase_nb, types_declaration);
+            continue;
+        }
+        int nb_referred = 0;
+        for (int link = types_referenced_phrase(ctx, phrase_nb); link != NO_DATA && !defined[link];
+             link = types_referenced_phrase(ctx, link)) {
+            defined[link] = true;
+            referred[nb_referred++] = link;
+        }
+        while (ok && nb_referred)
+            ok = add_line(ctx, output, referred[--nb_referred], types_typedef);
+        if (ok)
+            ok = add_line(ctx, output, phrase_nb, types_typedef_declaration);
     }
-    return ERROR;
+    free(defined);
+    free(referred);
+    return ok;
 }
 
-int process_pointer(char **argv) {
-    /* Check if we have singular or plural pointer. */
-    bool singular = true;
-    if (*(*(argv + current) + strlen(*(argv + current)) - 1) == 's')
-        singular = false;
-    
-    /* Handle the variable name (if any) according to the stage. */
-    if (!complex_variable())
-        return ERROR;
-    
-    /* current must now be 'to'.*/
-    if (strcmp(*(argv + current), "to"))
-        return ERROR;
-    
-    if (!inc_current())
-        return ERROR;
-    
-    /* output the star and move to the next word. */
-    output_at_front(original_phrase_nb, "*");
-
-    /* output and end if void. */
-    if (!strcmp(*(argv + current), "void")) {
-        output_at_front(original_phrase_nb, "void ");
-        return FINISHED;
+/* Add a line to an output buffer written by one of the functions that write the declaration of a
+ * phrase. */
+static bool add_line(types_context *ctx, output_buffer *output, int phrase_nb,
+                     int (*write_line)(const types_context *, int, char *, int)) {
+    /* Room is needed for the null written after the declaration, where its newline goes. */
+    int room = output->size - output->length;
+    int length = write_line(ctx, phrase_nb, output->text + output->length, room);
+    if (length >= room) {
+        if (!make_room(output, length + 1))
+            return false;
+        write_line(ctx, phrase_nb, output->text + output->length, length + 1);
     }
-    
-    if (singular) {
-        /* Check the proposition if pointer is singular and move to the next word. */
-        if (!inc_current())
-            return ERROR;        
-        if (!check_preposition(*(argv + current - 1), *(argv + current), false))
-            return ERROR;
+    output->length += length;
+    output->text[output->length++] = '\n';
+    return !output->to_stdout || output->length < OUTPUT_FLUSH || flush_output(output);
+}
+
+static bool add_output(output_buffer *output, const char *text, int length) {
+    if (!make_room(output, length))
+        return false;
+    memcpy(output->text + output->length, text, length);
+    output->length += length;
+    if (output->to_stdout && output->length >= OUTPUT_FLUSH)
+        return flush_output(output);
+    return true;
+}
+
+/* Make room for the given number of characters after the text of an output buffer, writing the
+ * text out first if it goes to standard output. Returns false after reporting an error. */
+static bool make_room(output_buffer *output, int length) {
+    if (output->length + length <= output->size)
+        return true;
+    if (output->to_stdout && !flush_output(output))
+        return false;
+    if (output->length + length > output->size) {
+        int size = output->size ? 2 * output->size : output->to_stdout ? 2 * OUTPUT_FLUSH : MIN_OUTPUT;
+        while (output->length + length > size)
+            size *= 2;
+        char *text = (char *) realloc(output->text, size);
+        if (!text) {
+            fprintf(stderr, "Out of memory\n");
+            return false;
+        }
+        output->text = text;
+        output->size = size;
     }
+    return true;
+}
 
-    /* One of 4 possibilities - pointer, array, function or datum (or their plurals).
-     * Paranetheses go outside pointer(s) to array(s) or function(s). */
-    if ((singular && !strcmp(*(argv + current), "pointer")) || (!singular && !strcmp(*(argv + current), "pointers")))
-        return CONTINUE;
-    if ((singular && !strcmp(*(argv + current), "array")) || (!singular && !strcmp(*(argv + current), "arrays"))) {
-        type[phrase_nb] = ARRAY;
-        output_at_front(original_phrase_nb, "(");
-        output_at_back(original_phrase_nb, ")");
-        return CONTINUE;
-    }
-    if ((singular && !strcmp(*(argv + current), "function")) || (!singular && !strcmp(*(argv + current), "functions"))) {
-        type[phrase_nb] = FUNCTION;
-        output_at_front(original_phrase_nb, "(");
-        output_at_back(original_phrase_nb, ")");        
-        return CONTINUE;
-    }
-    if ((singular && !strcmp(*(argv + current), "datum")) || (!singular && !strcmp(*(argv + current), "data")))
-        return data_continuation(argv);
-        
-    return ERROR;
+static bool flush_output(output_buffer *output) {
+    bool ok = write_out(output->text, output->length);
+    output->length = 0;
+    return ok;
 }
 
-int process_function(char **argv) {
-    /* Handle the variable name (if any) according to the stage. */
-    if (!complex_variable())
-        return ERROR;
-    
-    /* current must now be 'returning'.*/
-    if (strcmp(*(argv + current), "returning"))
-        return ERROR;
-     
-    if (!inc_current())
-        return ERROR;
-        
-    /* output the parentheses and move to the next word. */
-    output_at_back(original_phrase_nb, "()");
+/* Write all of a buffer to standard output. Returns false after reporting an error. */
+static bool write_out(const char *buffer, size_t length) {
+    while (length) {
+        ssize_t written = write(STDOUT_FILENO, buffer, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0) {
+            perror("write");
+            return false;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return true;
+}
 
-    /* output and end if void. */
-    if (!strcmp(*(argv + current), "void")) {
-        output_at_front(original_phrase_nb, "void ");
-        return FINISHED;
+/* Read documents separated by lines holding only DOCUMENT_DELIMITER from a file, or standard
+ * input if the file name is "-", and parse them with a thread for each processor. The output of
+ * each document, its declarations or "Incorrect input", is written in the order of the documents
+ * with the same lines between them. Returns EXIT_FAILURE if any document is in error. */
+static int run_batch(const char *file_name, bool typedefs) {
+    const char *text;
+    size_t size;
+    if (!read_file(file_name, &text, &size)) {
+        perror(file_name);
+        return EXIT_FAILURE;
+    }
+    batch batch = {.texts = NULL, .sizes = NULL, .nb_documents = 0, .documents_size = 0, .next = 0,
+                   .typedefs = typedefs};
+    bool ok = split_documents(text, size, &batch);
+    int nb_documents = batch.nb_documents;
+    if (ok && nb_documents) {
+        batch.outputs = (output_buffer *) calloc(nb_documents, sizeof(output_buffer));
+        batch.results = (int *) calloc(nb_documents, sizeof(int));
+        batch.done = (bool *) calloc(nb_documents, sizeof(bool));
+        ok = batch.outputs && batch.results && batch.done;
+    }
+    if (!ok) {
+        fprintf(stderr, "Out of memory\n");
+        free(batch.texts);
+        free(batch.sizes);
+        free(batch.outputs);
+        free(batch.results);
+        free(batch.done);
+        return EXIT_FAILURE;
     }
     
-    /* else we continue with a preposition. */
-    stage[original_phrase_nb] = CONTINUE;
-    if (!inc_current())
-        return ERROR;    
-    if (!check_preposition(*(argv + current - 1), *(argv + current), false))
-        return ERROR;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.document_done, NULL);
+    long nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nb_threads > nb_documents)
+        nb_threads = nb_documents;
+    pthread_t *threads = (pthread_t *) calloc(nb_threads > 0 ? nb_threads : 1, sizeof(pthread_t));
+    int nb_started = 0;
+    while (threads && nb_started < nb_threads && !pthread_create(&threads[nb_started], NULL, batch_thread, &batch))
+        ++nb_started;
     
-    /* then one of 2 possibilities - pointer or datum */
-    if (!strcmp(*(argv + current), "pointer")) {
-        type[phrase_nb] = POINTER;
-        return CONTINUE; 
+    /* Write each document out as soon as it and those before it are done. Without any thread,
+     * this thread parses the documents itself. */
+    output_buffer output = {.text = NULL, .length = 0, .size = 0, .to_stdout = true};
+    int status = EXIT_SUCCESS;
+    for (int document = 0; document < nb_documents; ++document) {
+        if (!nb_started)
+            batch_thread(&batch);
+        pthread_mutex_lock(&batch.lock);
+        while (!batch.done[document])
+            pthread_cond_wait(&batch.document_done, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+        
+        if (batch.results[document] != TYPES_OK)
+            status = EXIT_FAILURE;
+        if (ok && document)
+            ok = add_output(&output, DOCUMENT_DELIMITER "\n", strlen(DOCUMENT_DELIMITER) + 1);
+        if (ok && batch.results[document] != TYPES_NO_MEMORY)
+            ok = add_output(&output, batch.outputs[document].text, batch.outputs[document].length);
+        free(batch.outputs[document].text);
     }
-    if (!strcmp(*(argv + current), "datum"))
-        return data_continuation(argv);
-   
-    return ERROR;
+    if (ok)
+        ok = flush_output(&output);
+    
+    for (int thread = 0; thread < nb_started; ++thread)
+        pthread_join(threads[thread], NULL);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.document_done);
+    free(threads);
+    free(output.text);
+    free(batch.texts);
+    free(batch.sizes);
+    free(batch.outputs);
+    free(batch.results);
+    free(batch.done);
+    return ok ? status : EXIT_FAILURE;
 }
 
-int data_continuation(char **argv) {    
-    int previous_type = type[phrase_nb];
-    type[phrase_nb] = BASIC;  
-    
-    /* Must have 'of type'. */
-    if (!inc_current())
-        return ERROR;    
-    if (strcmp(*(argv + current), "of"))
-        return ERROR;
-    if (!inc_current())
-        return ERROR;    
-    if (strcmp(*(argv + current), "type"))
-        return ERROR;        
-    if (!inc_current())
-        return ERROR;    
-                
-    /* If we next have 'the type of' then REFER. */
-    if (!strcmp(*(argv + current), "the")) {
-        if (!inc_current())
-            return ERROR;    
-        if (strcmp(*(argv + current), "type"))
-            return ERROR;
-        if (!inc_current())
-            return ERROR;    
-        if (strcmp(*(argv + current), "of"))        
-            return ERROR;        
-      
-        phrase_nb = continuation[phrase_nb];
-        current = phrase_start[phrase_nb] + 1;
-        if (type[phrase_nb] == BASIC)
-            output_at_front(original_phrase_nb, " ");
-        /* Parentheses when refering from a pointer to and array or function. */
-        if (previous_type == POINTER && (type[phrase_nb] == FUNCTION || type[phrase_nb] == ARRAY)) {
-            output_at_front(original_phrase_nb, "(");
-            output_at_back(original_phrase_nb, ")");               
-        }   
-        return REFER;
-    }
-    else {
-        output_at_front(original_phrase_nb, " ");
-        return CONTINUE;        
+/* Split a text into documents at each line holding only DOCUMENT_DELIMITER, before any carriage
+ * return. Nothing but white space after the last delimiter is not a document. */
+static bool split_documents(const char *text, size_t size, batch *batch) {
+    size_t delimiter_length = strlen(DOCUMENT_DELIMITER);
+    size_t start = 0;
+    for (size_t line = 0; line < size; ) {
+        size_t end = line;
+        while (end < size && text[end] != '\n')
+            ++end;
+        size_t length = end - line;
+        if (length && text[end - 1] == '\r')
+            --length;
+        if (length == delimiter_length && !memcmp(text + line, DOCUMENT_DELIMITER, length)) {
+            if (!add_document(batch, text + start, line - start))
+                return false;
+            start = end + 1;
+        }
+        line = end + 1;
     }
+    
+    bool blank = true;
+    for (size_t i = start; i < size && blank; ++i)
+        blank = isspace((unsigned char) text[i]);
+    return blank || add_document(batch, text + start, size - start);
 }
 
-/* If the next word is within the current phrase then increment current, else return false for error. */
-bool inc_current(void) {
-    if (current == phrase_end[phrase_nb]) 
-        return false;
-    ++current;
+static bool add_document(batch *batch, const char *text, size_t size) {
+    if (batch->nb_documents == batch->documents_size) {
+        bool ok = true;
+        batch->documents_size = batch->documents_size ? 2 * batch->documents_size : MIN_PHRASES;
+        batch->texts = (const char **) reallocate(batch->texts, batch->documents_size * sizeof(char *), &ok);
+        batch->sizes = (size_t *) reallocate(batch->sizes, batch->documents_size * sizeof(size_t), &ok);
+        if (!ok)
+            return false;
+    }
+    batch->texts[batch->nb_documents] = text;
+    batch->sizes[batch->nb_documents++] = size;
     return true;
 }
 
-/* Handle named variables at the start of complex phrases. */
-bool complex_variable(void) {
-    /* Move the argv index past the variable name if there is one. */
-    if (!inc_current())
-        return false;
+/* Take the documents of a batch in turn, parse each with a context kept for this thread and keep
+ * its output, until none is left. */
+static void *batch_thread(void *argument) {
+    batch *batch = argument;
+    types_context *ctx = types_create();
+    if (ctx)
+        types_set_declarations(ctx, !batch->typedefs);
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int document = batch->next < batch->nb_documents ? batch->next++ : NO_DATA;
+        pthread_mutex_unlock(&batch->lock);
+        if (document == NO_DATA)
+            break;
         
-    if (stage[original_phrase_nb] == START && var_name[phrase_nb] != 0) {
-        if (!inc_current())
-            return false;
-        /* Add variable name to the output if we are at the START stage. */
-        output_at_front(original_phrase_nb, var_name[phrase_nb]);
+        output_buffer *output = &batch->outputs[document];
+        int result = ctx ? types_parse_text(ctx, batch->texts[document], batch->sizes[document]) : TYPES_NO_MEMORY;
+        if (result == TYPES_NO_MEMORY)
+            fprintf(stderr, "Out of memory\n");
+        else if (result == TYPES_OK ? !add_declarations(ctx, output, batch->typedefs) :
+                 !add_output(output, "Incorrect input\n", strlen("Incorrect input\n")))
+            result = TYPES_NO_MEMORY;
+        
+        pthread_mutex_lock(&batch->lock);
+        batch->results[document] = result;
+        batch->done[document] = true;
+        pthread_cond_broadcast(&batch->document_done);
+        pthread_mutex_unlock(&batch->lock);
     }
-    /* REFER must have a variable name, move on without output. */
-    if (stage[original_phrase_nb] == REFER)
-        if (!inc_current())
-            return false;
-    return true;    
+    types_destroy(ctx);
+    return NULL;
 }
 
-bool check_vowel(char letter) {
-    if (letter == 'a' || letter == 'e' || letter == 'i' || letter == 'o' || letter == 'u')
-        return true;
-    return false;
+#ifdef TYPES_STATS
+/* Write a line of tab separated fields for the time of each phase in seconds, including printing
+ * the declarations, then for each count. */
+static void report_stats(types_context *ctx, double print_seconds) {
+    static const char *const phases[TYPES_NB_PHASES] = {"tokenize", "first_pass", "resolve", "loop_check",
+                                                        "second_pass", "intern"};
+    static const char *const counts[TYPES_NB_COUNTS] = {"keyword_comparisons", "name_checks", "chain_steps",
+                                                        "references_followed", "output_characters"};
+    types_stats stats = types_last_stats(ctx);
+    for (int phase = 0; phase < TYPES_NB_PHASES; ++phase)
+        fprintf(stderr, "seconds\t%s\t%.6f\n", phases[phase], stats.seconds[phase]);
+    fprintf(stderr, "seconds\tprint\t%.6f\n", print_seconds);
+    for (int counter = 0; counter < TYPES_NB_COUNTS; ++counter)
+        fprintf(stderr, "count\t%s\t%lld\n", counts[counter], stats.counts[counter]);
 }
+#endif
 
-/* Checks usage of 'an' or 'a'. If we are at the start of a phrase then there should be a capital letter. */
-bool check_preposition(char *word_1, char *word_2, bool start) {
-    if (start) {
-        if (!strcmp(word_1, "A") && !check_vowel(*word_2))
-            return true;
-        if (!strcmp(word_1, "An") && check_vowel(*word_2))
+/* Read a file, or standard input if the file name is "-". A regular file is mapped
+ * into memory, anything else is read into a buffer. The file stays mapped, or the
+ * buffer allocated, as the words point into it. On failure errno tells why. */
+static bool read_file(const char *file_name, const char **text, size_t *size) {
+    int fd = strcmp(file_name, "-") ? open(file_name, O_RDONLY) : STDIN_FILENO;
+    if (fd == -1)
+        return false;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1)
+        return close_file(fd, NULL);
+    if (S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+        char *buffer = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer != MAP_FAILED) {
+            if (fd != STDIN_FILENO)
+                close(fd);
+            *text = buffer;
+            *size = file_stat.st_size;
             return true;
+        }
     }
-    else if (!strcmp(word_1, "a") && !check_vowel(*word_2))
-        return true;
-    else if (!strcmp(word_1, "an") && check_vowel(*word_2))
-        return true; 
+    char *buffer = NULL;
+    size_t buffer_size = 0;
+    ssize_t nb_read;
+    *size = 0;
+    do {
+        if (*size + READ_CHUNK > buffer_size) {
+            buffer_size = buffer_size ? 2 * buffer_size : READ_CHUNK;
+            char *new_buffer = (char *) realloc(buffer, buffer_size);
+            if (!new_buffer)
+                return close_file(fd, buffer);
+            buffer = new_buffer;
+        }
+        nb_read = read(fd, buffer + *size, buffer_size - *size);
+        if (nb_read > 0)
+            *size += nb_read;
+    } while (nb_read > 0 || (nb_read == -1 && errno == EINTR));
+    if (nb_read == -1)
+        return close_file(fd, buffer);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    *text = buffer;
+    return true;
+}
+
+/* Close a file that could not be read, unless it is standard input, and free the buffer read so
+ * far, keeping errno. Returns false. */
+static bool close_file(int fd, char *buffer) {
+    int error = errno;
+    if (fd != STDIN_FILENO)
+        close(fd);
+    free(buffer);
+    errno = error;
     return false;
 }
 
-int first_phrase_type(char *word) {
-    if (!strcmp(word, "array"))
-        return ARRAY;
-    else if (!strcmp(word, "pointer"))
-        return POINTER;
-    else if (!strcmp(word, "function"))
-        return FUNCTION;
-    else 
-        return BASIC;
+/* Serve a document to standard input and output, or to the clients of a Unix socket one after
+ * the other. Each command is a line:
+ *     add PHRASE           replies "ok ID"
+ *     update ID PHRASE     replies "ok"
+ *     delete ID            replies "ok"
+ *     print [ID]           replies with the declaration of the phrase, or of each phrase in turn
+ *                          followed by an empty line, or "Incorrect input" if the document has
+ *                          an error
+ *     quit                 ends the session
+ * and anything else replies "error" and why. */
+static int serve_document(const char *socket_path) {
+    types_document *doc = types_document_create();
+    if (!doc) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    if (!socket_path) {
+        bool ok = serve_commands(doc, stdin, stdout);
+        types_document_destroy(doc);
+        if (!ok)
+            fprintf(stderr, "Out of memory\n");
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    
+    /* The path and its null must fit in the address, else another path would be bound. */
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        types_document_destroy(doc);
+        return EXIT_FAILURE;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1) {
+        perror(socket_path);
+        types_document_destroy(doc);
+        return EXIT_FAILURE;
+    }
+    
+    /* Only a socket left by an earlier daemon is replaced, never any other file. */
+    struct stat path_stat;
+    bool ok = true;
+    if (lstat(socket_path, &path_stat) == 0) {
+        if (!S_ISSOCK(path_stat.st_mode)) {
+            fprintf(stderr, "%s: exists and is not a socket\n", socket_path);
+            ok = false;
+        }
+        else if (unlink(socket_path) == -1) {
+            perror(socket_path);
+            ok = false;
+        }
+    }
+    else if (errno != ENOENT) {
+        perror(socket_path);
+        ok = false;
+    }
+    if (ok && (bind(listener, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(listener, 1) == -1)) {
+        perror(socket_path);
+        ok = false;
+    }
+    if (!ok) {
+        close(listener);
+        types_document_destroy(doc);
+        return EXIT_FAILURE;
+    }
+    
+    /* A client going away while a reply is written to it only ends its session. */
+    signal(SIGPIPE, SIG_IGN);
+    bool out_of_memory = false;
+    while (!out_of_memory) {
+        int client = accept(listener, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+                continue;
+            /* Wait for descriptors or buffers to be freed before trying again. */
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                sleep(ACCEPT_BACKOFF);
+                continue;
+            }
+            perror(socket_path);
+            break;
+        }
+        int client_out = dup(client);
+        FILE *in = fdopen(client, "r");
+        FILE *out = client_out == -1 ? NULL : fdopen(client_out, "w");
+        if (in && out)
+            out_of_memory = !serve_commands(doc, in, out);
+        if (in)
+            fclose(in);
+        else
+            close(client);
+        if (out)
+            fclose(out);
+        else if (client_out != -1)
+            close(client_out);
+    }
+    if (out_of_memory)
+        fprintf(stderr, "Out of memory\n");
+    close(listener);
+    unlink(socket_path);
+    types_document_destroy(doc);
+    return EXIT_FAILURE;
 }
 
-bool ends_with_full_stop(char *word) {
-    if (*(word + strlen(word) - 1) == '.')
+/* Run the commands of a session until it ends, or its replies can no longer be written. Returns
+ * false if out of memory. */
+static bool serve_commands(types_document *doc, FILE *in, FILE *out) {
+    char *line = NULL;
+    size_t line_size = 0;
+    bool ok = true;
+    while (ok && getline(&line, &line_size, in) != -1) {
+        if (!strncmp(line, "quit", 4) && (!line[4] || isspace((unsigned char) line[4])))
+            break;
+        ok = run_command(doc, line, out);
+        if (fflush(out) == EOF || ferror(out))
+            break;
+    }
+    free(line);
+    return ok;
+}
+
+/* Returns false if out of memory. */
+static bool run_command(types_document *doc, char *line, FILE *out) {
+    char *command = strtok(line, " \t\r\n");
+    char *rest = strtok(NULL, "\r\n");
+    int phrase_id = NO_DATA;
+    if (rest && command && strcmp(command, "add")) {
+        char *end;
+        errno = 0;
+        long value = strtol(rest, &end, 10);
+        if (end == rest || errno == ERANGE || value < 0 || value > INT_MAX) {
+            fprintf(out, "error bad phrase ID\n");
+            return true;
+        }
+        phrase_id = (int) value;
+        rest = end;
+    }
+    
+    int result;
+    if (!command)
         return true;
-    return false;
+    else if (!strcmp(command, "add") && rest) {
+        result = types_document_add(doc, rest, strlen(rest), &phrase_id);
+        if (result == TYPES_OK)
+            fprintf(out, "ok %d\n", phrase_id);
+    }
+    else if (!strcmp(command, "update") && phrase_id != NO_DATA)
+        result = types_document_update(doc, phrase_id, rest, strlen(rest));
+    else if (!strcmp(command, "delete") && phrase_id != NO_DATA)
+        result = types_document_delete(doc, phrase_id);
+    else if (!strcmp(command, "print"))
+        return print_document(doc, phrase_id, out);
+    else {
+        fprintf(out, "error unknown command\n");
+        return true;
+    }
+    
+    if (result == TYPES_OK && strcmp(command, "add"))
+        fprintf(out, "ok\n");
+    else if (result == TYPES_NO_PHRASE)
+        fprintf(out, "error not a single phrase\n");
+    else if (result == TYPES_NO_SUCH_PHRASE)
+        fprintf(out, "error no phrase %d\n", phrase_id);
+    return result != TYPES_NO_MEMORY;
 }
-             
-bool permitted_variable_name(char *variable_name) {
-    /* Check list of reserved words. */
-    for (int illegal_var_nb = 0; illegal_var_nb < NB_ILLEGAL_VARIABLES; ++illegal_var_nb) {
-        if (!strcmp(variable_name, illegal_variables[illegal_var_nb]))
-            return false;
+
+/* Print the declaration of a phrase, or of every phrase if the ID is NO_DATA.
+ * Returns false if out of memory. */
+static bool print_document(types_document *doc, int phrase_id, FILE *out) {
+    if (phrase_id != NO_DATA && !types_document_has_phrase(doc, phrase_id)) {
+        fprintf(out, "error no phrase %d\n", phrase_id);
+        return true;
     }
-    /* Cannot begin with a digit or be empty. */
-    if (isdigit(*variable_name) || *variable_name == '\0')
-        return false;
-    /* Can only have alphanumeric characters or underscores. */
-    while (*variable_name != '\0') {
-        if (!isalnum(*variable_name) && *variable_name != '_')
+    if (types_document_error(doc).code != TYPES_OK) {
+        fprintf(out, "Incorrect input\n");
+        return true;
+    }
+    char buffer[MIN_OUTPUT];
+    int first = phrase_id == NO_DATA ? 0 : phrase_id;
+    int last = phrase_id == NO_DATA ? types_document_nb_phrases(doc) - 1 : phrase_id;
+    for (int link = first; link <= last && !ferror(out); ++link) {
+        if (!types_document_has_phrase(doc, link))
+            continue;
+        int length = types_document_declaration(doc, link, buffer, sizeof(buffer));
+        if (length == NO_DATA)
             return false;
-        ++variable_name;
+        if (length < (int) sizeof(buffer))
+            fprintf(out, "%s\n", buffer);
+        else {
+            char *long_buffer = (char *) malloc(length + 1);
+            if (!long_buffer)
+                return false;
+            types_document_declaration(doc, link, long_buffer, length + 1);
+            fprintf(out, "%s\n", long_buffer);
+            free(long_buffer);
+        }
     }
+    if (phrase_id == NO_DATA)
+        fprintf(out, "\n");
     return true;
 }
 
-int read_basic_phrase(int basic_start, int basic_end, char **argv) {
-    /* Set basic phrase type to zero. */
-    int basic_phrase_type = 0;
+/* Name the phrases (numbered from 1) that make up the loop on standard error. */
+static void report_reference_loop(types_context *ctx, int loop_phrase) {
+    int phrase = loop_phrase;
+    const char *name;
+    fprintf(stderr, "Loop in variable references:");
+    do {
+        int length = types_variable_name(ctx, phrase, &name);
+        fprintf(stderr, " phrase %d (%.*s) ->", phrase + 1, length, name);
+        phrase = types_referenced_phrase(ctx, phrase);
+    } while (phrase != loop_phrase);
+    fprintf(stderr, " phrase %d\n", phrase + 1);
+}
+#endif
 
-    /* Loop over the words. */
-    for (int word_nb = basic_start; word_nb <= basic_end; ++word_nb) {
+types_context *types_create(void) {
+    types_context *ctx = (types_context *) calloc(1, sizeof(types_context));
+    if (!ctx)
+        return NULL;
+    ctx->max_phrase_index = NO_DATA;
+    ctx->nb_threads = 1;
+    ctx->write_types = true;
+    return ctx;
+}
 
-        /* If its not a basic word type and not the last word of the phrase then exit. */
-        int word_type = basic_word_type(*(argv + word_nb));
-        if (!word_type && word_nb != basic_end)
-            return false;
-        
-        /* If is long ... */
-        if (word_type == LONG) {
-            if (basic_phrase_type & LONGLONG)
-                return false;
-            else if (basic_phrase_type & LONG) {
-                basic_phrase_type = basic_phrase_type ^ LONG;
-                basic_phrase_type = basic_phrase_type | LONGLONG;
-            }
-            else
-                basic_phrase_type = basic_phrase_type | LONG;            
+void types_destroy(types_context *ctx) {
+    if (!ctx)
+        return;
+    if (ctx->pool)
+        stop_pool(ctx->pool);
+    for (int arena_nb = 0; arena_nb < ctx->nb_arenas; ++arena_nb)
+        free_arena(&ctx->arenas[arena_nb]);
+    free(ctx->arenas);
+    free(ctx->words);
+    free(ctx->phrase_table);
+    free(ctx->declarator_stack);
+    free(ctx->type_nodes);
+    free(ctx->type_index);
+    free(ctx->type_output);
+    free(ctx);
+}
+
+/* Each word is split from the next by the caller. */
+int types_parse_words(types_context *ctx, int nb_words, char **words) {
+    START_STATS(ctx);
+    ctx->nb_words = 0;
+    ctx->max_phrase_index = NO_DATA;
+    for (int word_nb = 0; word_nb < nb_words; ++word_nb)
+        if (!add_word(ctx, *(words + word_nb), strlen(*(words + word_nb))))
+            return fail(ctx, TYPES_NO_MEMORY, NO_DATA);
+    END_PHASE(ctx, TYPES_TOKENIZE);
+    return parse_phrases(ctx);
+}
+
+int types_parse_text(types_context *ctx, const char *text, size_t size) {
+    START_STATS(ctx);
+    ctx->nb_words = 0;
+    ctx->max_phrase_index = NO_DATA;
+    if (!words_from_buffer(ctx, text, size))
+        return fail(ctx, TYPES_NO_MEMORY, NO_DATA);
+    END_PHASE(ctx, TYPES_TOKENIZE);
+    return parse_phrases(ctx);
+}
+
+/* The pool is started again at the next parse with enough work. */
+void types_set_threads(types_context *ctx, int nb_threads) {
+    if (ctx->pool && ctx->pool->nb_workers != nb_threads) {
+        stop_pool(ctx->pool);
+        ctx->pool = NULL;
+    }
+    ctx->nb_threads = nb_threads > 1 ? nb_threads : 1;
+}
+
+void types_set_declarations(types_context *ctx, int write_types) {
+    ctx->write_types = write_types;
+}
+
+types_error types_last_error(const types_context *ctx) {
+    return ctx->error;
+}
+
+int types_nb_phrases(const types_context *ctx) {
+    return ctx->error.code == TYPES_OK ? ctx->max_phrase_index + 1 : 0;
+}
+
+int types_declaration(const types_context *ctx, int phrase_nb, char *buffer, int size) {
+    const type_node *type = &ctx->type_nodes[ctx->type_id[phrase_nb]];
+    if (type->output_length == NO_DATA)
+        return write_full_declaration(ctx, phrase_nb, buffer, size);
+    const char *output = ctx->type_output + type->output;
+    word name = ctx->var_name[phrase_nb];
+    int position = 0;
+    
+    /* A basic phrase without a variable name is only its basic type, without the space. */
+    int before_name = type->name_position;
+    if (type->kind == BASIC && !name.length)
+        --before_name;
+    for (int i = 0; i < before_name; ++i)
+        put_char(buffer, size, position++, output[i]);
+    for (int i = 0; i < name.length; ++i)
+        put_char(buffer, size, position++, name.text[i]);
+    for (int i = type->name_position; i < type->output_length; ++i)
+        put_char(buffer, size, position++, output[i]);
+    
+    if (size > 0)
+        buffer[position < size ? position : size - 1] = '\0';
+    return position;
+}
+
+int types_type_id(const types_context *ctx, int phrase_nb) {
+    return ctx->type_id[phrase_nb];
+}
+
+int types_referenced_phrase(const types_context *ctx, int phrase_nb) {
+    return ctx->continuation[phrase_nb];
+}
+
+int types_variable_name(const types_context *ctx, int phrase_nb, const char **name) {
+    *name = ctx->var_name[phrase_nb].text;
+    return ctx->var_name[phrase_nb].length;
+}
+
+int types_typedef(const types_context *ctx, int phrase_nb, char *buffer, int size) {
+    return write_own_declaration(ctx, phrase_nb, true, buffer, size);
+}
+
+int types_typedef_declaration(const types_context *ctx, int phrase_nb, char *buffer, int size) {
+    if (!ctx->reference_node[phrase_nb])
+        return types_declaration(ctx, phrase_nb, buffer, size);
+    return write_own_declaration(ctx, phrase_nb, false, buffer, size);
+}
+
+#ifdef TYPES_STATS
+types_stats types_last_stats(const types_context *ctx) {
+    return ctx->stats;
+}
+
+/* Clear the times and counts, and start timing the first phase. */
+static void start_stats(types_context *ctx) {
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    memset(thread_counts, 0, sizeof(thread_counts));
+    ctx->phase_start = stats_clock();
+}
+
+/* Add the time since the last phase ended to a phase. */
+static void end_phase(types_context *ctx, int phase) {
+    double now = stats_clock();
+    ctx->stats.seconds[phase] += now - ctx->phase_start;
+    ctx->phase_start = now;
+}
+
+/* Add the counts of this thread to the context. Pool threads hold the pool lock to do so. */
+static void add_counts(types_context *ctx) {
+    for (int counter = 0; counter < TYPES_NB_COUNTS; ++counter) {
+        ctx->stats.counts[counter] += thread_counts[counter];
+        thread_counts[counter] = 0;
+    }
+}
+
+static double stats_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+#endif
+
+/* Record the error found and return it. */
+static int fail(types_context *ctx, int code, int phrase_nb) {
+    ctx->error.code = code;
+    ctx->error.phrase = phrase_nb;
+    return code;
+}
+
+/* The phases of parsing a phrase set, each returning TYPES_OK or the error found. */
+static int parse_phrases(types_context *ctx) {
+    int result = prepare_phrases(ctx);
+    if (result == TYPES_OK)
+        result = first_pass(ctx);
+    END_PHASE(ctx, TYPES_FIRST_PASS);
+    if (result == TYPES_OK)
+        result = resolve_references(ctx);
+    END_PHASE(ctx, TYPES_RESOLVE);
+    if (result == TYPES_OK)
+        result = check_reference_loops(ctx);
+    END_PHASE(ctx, TYPES_LOOP_CHECK);
+    if (result == TYPES_OK)
+        result = second_pass(ctx);
+    END_PHASE(ctx, TYPES_SECOND_PASS);
+    if (result == TYPES_OK && (!intern_phrase_types(ctx) || !choose_typedef_suffix(ctx)))
+        result = fail(ctx, TYPES_NO_MEMORY, NO_DATA);
+    END_PHASE(ctx, TYPES_INTERN);
+    ADD_COUNTS(ctx);
+    return result;
+}
+
+static int prepare_phrases(types_context *ctx) {
+    ctx->error.code = TYPES_OK;
+    ctx->error.phrase = NO_DATA;
+    
+    /* Check that we have at least one phrase and that the final phrase ends at the last word. */
+    if (ctx->max_phrase_index == NO_DATA || ctx->phrase_end[ctx->max_phrase_index] != ctx->nb_words - 1)
+        return fail(ctx, TYPES_NO_PHRASE, NO_DATA);
+    if (!reserve_arenas(ctx, 1))
+        return fail(ctx, TYPES_NO_MEMORY, NO_DATA);
+    for (int arena_nb = 0; arena_nb < ctx->nb_arenas; ++arena_nb)
+        reset_arena(&ctx->arenas[arena_nb]);
+    return TYPES_OK;
+}
+
+/* First pass through phrases to find variable names, references and process basic phrases. */
+static int first_pass(types_context *ctx) {
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb) {
+        int result = scan_phrase(ctx, phrase_nb);
+        if (result != TYPES_OK)
+            return fail(ctx, result, phrase_nb);
+    }
+    return TYPES_OK;
+}
+
+/* Resolve each referenced variable through a hash index of the variable names.
+ * There can be only one phrase declaring the referenced variable. */
+static int resolve_references(types_context *ctx) {
+    index_variable_names(ctx);
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb) {
+        if (!ctx->reference[phrase_nb].text)
+            continue;
+        ctx->continuation[phrase_nb] = find_variable(ctx, ctx->reference[phrase_nb]);
+        if (ctx->continuation[phrase_nb] == NO_DATA)
+            return fail(ctx, TYPES_UNKNOWN_VARIABLE, phrase_nb);
+    }
+    return TYPES_OK;
+}
+
+/* Check that variable references do not create a loop. */
+static int check_reference_loops(types_context *ctx) {
+    int loop_phrase = find_reference_loop(ctx);
+    if (loop_phrase != NO_DATA)
+        return fail(ctx, TYPES_REFERENCE_LOOP, loop_phrase);
+    return TYPES_OK;
+}
+
+/* Second pass through to process the complex phrases. Each phrase is parsed once, up to
+ * any reference to another phrase, into a declarator tree. The tree then leads on to the
+ * tree of the referenced phrase. The first phrase in error is reported as before. */
+static int second_pass(types_context *ctx) {
+    run_job(ctx, parse_complex_phrase, ctx->max_phrase_index + 1);
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb) {
+        if (ctx->stage[phrase_nb] == ERROR)
+            return fail(ctx, TYPES_BAD_PHRASE, phrase_nb);
+        if (ctx->stage[phrase_nb] == OUT_OF_MEMORY)
+            return fail(ctx, TYPES_NO_MEMORY, phrase_nb);
+    }
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb)
+        if (ctx->reference_node[phrase_nb]) {
+            ctx->reference_node[phrase_nb]->next = ctx->root[ctx->continuation[phrase_nb]];
+            COUNT(TYPES_REFERENCES_FOLLOWED);
         }
-        /* If it's not 'long' then exit if we have see it before otherwise set that bit. */
-        else if (basic_phrase_type & word_type)
-            return false;
+    return TYPES_OK;
+}
+
+/* The first pass over a phrase: find its variable name and any reference, and process it if
+ * it is basic. Returns TYPES_OK, or the error that stops the first pass. */
+static int scan_phrase(types_context *ctx, int phrase_nb) {
+    phrase_task task = {ctx, phrase_nb, ctx->phrase_start[phrase_nb] + 1, &ctx->arenas[0], &ctx->root[phrase_nb], false};
+    ctx->stage[phrase_nb] = START;
+    ctx->type[phrase_nb]= BASIC;
+    ctx->continuation[phrase_nb] = NO_DATA;
+    ctx->chain[phrase_nb] = UNVISITED;
+    ctx->var_name[phrase_nb] = ctx->reference[phrase_nb] = (word) {NULL, 0};
+    ctx->root[phrase_nb] = ctx->reference_node[phrase_nb] = NULL;
+
+    /* Check that phrase has at least 2 words. */
+    if (ctx->phrase_end[phrase_nb] - ctx->phrase_start[phrase_nb] < (MIN_BASIC - 1))
+        return TYPES_SHORT_PHRASE;
+
+    /* Check correct usage of preposition 'A' or 'An'. */
+    if (!check_preposition(ctx->words[task.current - 1], current_word(&task)))
+        return TYPES_BAD_ARTICLE;
+
+    /* Identify complex phrases (array, pointer or function) and process basic phrases. */
+    ctx->type[phrase_nb] = first_phrase_type(current_word(&task));
+    if (ctx->type[phrase_nb] == BASIC) {
+        ctx->stage[phrase_nb] = process_basic(&task);
+        if (task.out_of_memory)
+            ctx->stage[phrase_nb] = OUT_OF_MEMORY;
+        return TYPES_OK;
+    }
+
+    /* Check that each complex phrase has the minimum length. */
+    if (ctx->phrase_end[phrase_nb] - ctx->phrase_start[phrase_nb] < (MIN_COMPLEX - 1))
+        return TYPES_SHORT_PHRASE;
+
+    /* If the 3rd word of an ARRAY phrase is not 'of', or POINTER is not 'to', or FUNCTION
+     * is not 'returning' then check if the variable name is valid and store it. */
+    ++task.current;
+    if ((ctx->type[phrase_nb] == ARRAY && !word_is(current_word(&task), "of")) ||
+        (ctx->type[phrase_nb] == POINTER && !word_is(current_word(&task), "to")) ||
+        (ctx->type[phrase_nb] == FUNCTION && !word_is(current_word(&task), "returning"))) {
+        if (!permitted_variable_name(current_word(&task)))
+            ctx->stage[phrase_nb] = ERROR;
         else
-            basic_phrase_type = basic_phrase_type | word_type;
+            ctx->var_name[phrase_nb] = current_word(&task);
+    }
+
+    /* If the last word of the complex phrase is a permitted variable name then
+     * it is a referenced variable. */
+    if (permitted_variable_name(ctx->words[ctx->phrase_end[phrase_nb]]))
+        ctx->reference[phrase_nb] = ctx->words[ctx->phrase_end[phrase_nb]];
+    return TYPES_OK;
+}
+
+/* Parse a complex phrase from its start until it is finished, refers to another phrase or is in
+ * error, allocating its declarators from the arena of the worker. Basic phrases are parsed by the
+ * first pass. */
+static void parse_complex_phrase(types_context *ctx, int phrase_nb, int worker) {
+    if (ctx->stage[phrase_nb] != START)
+        return;
+    phrase_task task = {ctx, phrase_nb, ctx->phrase_start[phrase_nb] + 1, &ctx->arenas[worker], &ctx->root[phrase_nb], false};
+    ctx->stage[phrase_nb] = process_complex(&task);
+    if (task.out_of_memory)
+        ctx->stage[phrase_nb] = OUT_OF_MEMORY;
+}
+
+/* Run a job on each item of work from 0 up, in this thread, or shared with the pool when there
+ * are enough items. */
+static void run_job(types_context *ctx, pool_job *job, int nb_items) {
+    if (ctx->nb_threads == 1 || nb_items < MIN_PARALLEL_ITEMS) {
+        for (int item = 0; item < nb_items; ++item)
+            job(ctx, item, 0);
+        return;
+    }
+    if ((!ctx->pool && !(ctx->pool = start_pool(ctx, ctx->nb_threads))) ||
+        !reserve_arenas(ctx, ctx->pool->nb_workers)) {
+        ctx->nb_threads = 1;
+        run_job(ctx, job, nb_items);
+        return;
     }
+    thread_pool *pool = ctx->pool;
     
-    basic_phrase_type = standardise_basic_phrase(basic_phrase_type);
-    if (!basic_phrase_type)
-        return false;
+    /* Each worker starts with an equal range of consecutive items. */
+    for (int worker = 0; worker < pool->nb_workers; ++worker) {
+        pool->ranges[worker].next = (long) nb_items * worker / pool->nb_workers;
+        pool->ranges[worker].end = (long) nb_items * (worker + 1) / pool->nb_workers;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->nb_busy = pool->nb_workers - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
     
-    return basic_phrase_type;
-}
-
-int basic_word_type(char *word) {
-    if (!strcmp(word, "int"))
-        return INT;
-    if (!strcmp(word, "char"))
-        return CHAR;
-    if (!strcmp(word, "double"))
-        return DOUBLE;
-    if (!strcmp(word, "float"))
-        return FLOAT;    
-    if (!strcmp(word, "signed"))
-        return SIGNED;
-    if (!strcmp(word, "unsigned"))
-        return UNSIGNED;
-    if (!strcmp(word, "short"))
-        return SHORT;
-    if (!strcmp(word, "long"))
-        return LONG;
-    return 0;
-}
-
-int standardise_basic_phrase(int basic_phrase_type) {
-    
-    /* There must be some input. */
-    if (!basic_phrase_type)
-        return false;
+    work_on_ranges(ctx, pool, 0);
     
-    /* If it's none of char, float or double then it is an int. */
-    if (!(basic_phrase_type & (CHAR + DOUBLE + FLOAT)))
-        basic_phrase_type = basic_phrase_type | INT;
+    pthread_mutex_lock(&pool->lock);
+    while (pool->nb_busy)
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
 
-    /* If it's an int and not unsigned then it's signed. */
-    if ((basic_phrase_type & INT) && !(basic_phrase_type & UNSIGNED))
-        basic_phrase_type |= SIGNED;    
+static thread_pool *start_pool(types_context *ctx, int nb_workers) {
+    thread_pool *pool = (thread_pool *) calloc(1, sizeof(thread_pool));
+    if (!pool)
+        return NULL;
+    pool->threads = (pthread_t *) calloc(nb_workers, sizeof(pthread_t));
+    pool->ranges = (work_range *) calloc(nb_workers, sizeof(work_range));
+    if (!pool->threads || !pool->ranges) {
+        free(pool->threads);
+        free(pool->ranges);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->ctx = ctx;
+    for (int worker = 0; worker < nb_workers; ++worker)
+        pthread_mutex_init(&pool->ranges[worker].lock, NULL);
+    pool->nb_workers = 1;
+    for (int worker = 1; worker < nb_workers; ++worker) {
+        if (pthread_create(&pool->threads[worker], NULL, pool_thread, pool))
+            break;
+        ++pool->nb_workers;
+    }
+    return pool;
+}
+
+static void stop_pool(thread_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int worker = 1; worker < pool->nb_workers; ++worker)
+        pthread_join(pool->threads[worker], NULL);
+    for (int worker = 0; worker < pool->nb_workers; ++worker)
+        pthread_mutex_destroy(&pool->ranges[worker].lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool->ranges);
+    free(pool);
+}
 
-    /* Fail for combinations that are not allowed. */
-    if (basic_phrase_type & INT) {
-        if (basic_phrase_type & (CHAR + DOUBLE + FLOAT))
+/* Wait for each new generation of work, then share it with the other workers. */
+static void *pool_thread(void *argument) {
+    thread_pool *pool = (thread_pool *) argument;
+    int generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    int worker = ++pool->nb_started;
+    for (;;) {
+        while (!pool->quit && pool->generation == generation)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if (pool->quit)
+            break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        
+        work_on_ranges(pool->ctx, pool, worker);
+        
+        pthread_mutex_lock(&pool->lock);
+        ADD_COUNTS(pool->ctx);
+        if (!--pool->nb_busy)
+            pthread_cond_signal(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void work_on_ranges(types_context *ctx, thread_pool *pool, int worker) {
+    int from, to;
+    while (take_work(pool, worker, &from, &to))
+        for (int item = from; item < to; ++item)
+            pool->job(ctx, item, worker);
+}
+
+/* Take a chunk of items from the front of the worker's own range. When that is empty, steal
+ * the back half of the largest range left to another worker. Only one lock is held at a time.
+ * Returns false when no work is left. */
+static bool take_work(thread_pool *pool, int worker, int *from, int *to) {
+    work_range *own = &pool->ranges[worker];
+    for (;;) {
+        pthread_mutex_lock(&own->lock);
+        if (own->next < own->end) {
+            *from = own->next;
+            *to = own->end - own->next > PARALLEL_CHUNK ? own->next + PARALLEL_CHUNK : own->end;
+            own->next = *to;
+            pthread_mutex_unlock(&own->lock);
+            return true;
+        }
+        pthread_mutex_unlock(&own->lock);
+        
+        int victim = NO_DATA;
+        int most_left = 0;
+        for (int other = 0; other < pool->nb_workers; ++other) {
+            pthread_mutex_lock(&pool->ranges[other].lock);
+            if (pool->ranges[other].end - pool->ranges[other].next > most_left) {
+                most_left = pool->ranges[other].end - pool->ranges[other].next;
+                victim = other;
+            }
+            pthread_mutex_unlock(&pool->ranges[other].lock);
+        }
+        if (victim == NO_DATA)
             return false;
-        if ((basic_phrase_type & SIGNED) && (basic_phrase_type & UNSIGNED))
+        
+        work_range *range = &pool->ranges[victim];
+        pthread_mutex_lock(&range->lock);
+        int middle = range->next + (range->end - range->next) / 2;
+        int stolen_end = range->end;
+        if (middle < stolen_end)
+            range->end = middle;
+        pthread_mutex_unlock(&range->lock);
+        if (middle < stolen_end) {
+            pthread_mutex_lock(&own->lock);
+            own->next = middle;
+            own->end = stolen_end;
+            pthread_mutex_unlock(&own->lock);
+        }
+    }
+}
+
+static int process_basic(phrase_task *task) {
+    types_context *ctx = task->ctx;
+    int phrase_nb = task->phrase_nb;
+    int last_word = ctx->phrase_end[phrase_nb];
+    int c_type = 0;
+
+    if (!specifier_bit(ctx->words[last_word])) {
+        if (!permitted_variable_name(ctx->words[last_word]))
+            return ERROR;
+        else {
+            /* Store the variable name in var_name array.
+             * Read the rest of basic phrase apart from the variable name and preposition. */
+            ctx->var_name[phrase_nb] = ctx->words[last_word];
+            c_type = read_basic_phrase(ctx, ctx->phrase_start[phrase_nb] + 1, last_word - 1);
+        }
+    }
+    else
+        /* No named variable so read all of the basic phrase apart from the preposition. */
+        c_type = read_basic_phrase(ctx, ctx->phrase_start[phrase_nb] + 1, last_word);
+
+    if (!c_type)
+        return ERROR;
+
+    if (!add_declarator(task, BASIC, c_type_outputs[c_type]))
+        return ERROR;
+    return FINISHED;
+}
+
+/* Walk the grammar from the word after the first word and any variable name, one word at a time,
+ * until an action ends the phrase. Running out of words or a word without a transition is an
+ * error. */
+static int process_complex(phrase_task *task) {
+    types_context *ctx = task->ctx;
+    int phrase_nb = task->phrase_nb;
+    int last_word = ctx->phrase_end[phrase_nb];
+    int state = first_states[ctx->type[phrase_nb]];
+    for (task->current += ctx->var_name[phrase_nb].text ? 2 : 1; task->current <= last_word; ++task->current) {
+        transition step = grammar[state][word_token(current_word(task))];
+        if (!step.next && !step.action)
+            step = otherwise[state];
+        if (step.action) {
+            int stage = take_action(task, step.action);
+            if (stage != START)
+                return stage;
+        }
+        else if (!step.next)
+            return ERROR;
+        state = step.next;
+    }
+    return ERROR;
+}
+
+/* Take the action of a transition on the current word. Returns the stage the phrase ends in, or
+ * START to go on. */
+static int take_action(phrase_task *task, int action) {
+    types_context *ctx = task->ctx;
+    int phrase_nb = task->phrase_nb;
+    switch (action) {
+        case ADD_ARRAY:
+            return add_declarator(task, ARRAY, current_word(task)) ? START : ERROR;
+        case ADD_POINTER:
+            return add_declarator(task, POINTER, (word) {NULL, 0}) ? START : ERROR;
+        case ADD_FUNCTION:
+            return add_declarator(task, FUNCTION, (word) {NULL, 0}) ? START : ERROR;
+        case END_VOID:
+            return add_declarator(task, BASIC, (word) {"void", 4}) ? FINISHED : ERROR;
+        case END_BASIC: {
+            int c_type = read_basic_phrase(ctx, task->current, ctx->phrase_end[phrase_nb]);
+            return c_type && add_declarator(task, BASIC, c_type_outputs[c_type]) ? FINISHED : ERROR;
+        }
+        default:
+            /* The rest of the tree is that of the referenced phrase. */
+            if (!ctx->reference[phrase_nb].text)
+                return ERROR;
+            ctx->reference_node[phrase_nb] = add_declarator(task, REFERENCE, (word) {NULL, 0});
+            return ctx->reference_node[phrase_nb] ? REFER : ERROR;
+    }
+}
+
+/* The token of a word of a complex phrase. */
+static int word_token(word word) {
+    if (!word.length)
+        return OTHER_WORD;
+    char first = *word.text;
+    if (isdigit((unsigned char) first)) {
+        int elements = word_value(word);
+        return elements == 1 ? ONE : elements > 1 ? MANY : OTHER_WORD;
+    }
+    if (word.length > MAX_KEYWORD_LENGTH || first < 'a' || first > 'z')
+        return OTHER_WORD;
+    int token = keyword_tokens[word.length][first - 'a'];
+    COUNT(TYPES_KEYWORD_COMPARISONS);
+    if (token && !memcmp(word.text, keywords[token - FIRST_KEYWORD], word.length))
+        return token;
+    return OTHER_WORD;
+}
+
+static word current_word(phrase_task *task) {
+    return task->ctx->words[task->current];
+}
+
+static bool check_vowel(char letter) {
+    if (letter == 'a' || letter == 'e' || letter == 'i' || letter == 'o' || letter == 'u')
+        return true;
+    return false;
+}
+
+/* Checks usage of 'An' or 'A' at the start of a phrase. The articles inside complex phrases are
+ * part of their grammar. */
+static bool check_preposition(word word_1, word word_2) {
+    bool vowel = word_2.length && check_vowel(*word_2.text);
+    if (word_is(word_1, "A") && !vowel)
+        return true;
+    if (word_is(word_1, "An") && vowel)
+        return true;
+    return false;
+}
+
+static int first_phrase_type(word word) {
+    if (word_is(word, "array"))
+        return ARRAY;
+    else if (word_is(word, "pointer"))
+        return POINTER;
+    else if (word_is(word, "function"))
+        return FUNCTION;
+    else
+        return BASIC;
+}
+
+/* Compare a word with a null terminated string. */
+static bool word_is(word word, const char *string) {
+    COUNT(TYPES_KEYWORD_COMPARISONS);
+    return strlen(string) == (size_t) word.length && !memcmp(word.text, string, word.length);
+}
+
+static bool same_words(word word_1, word word_2) {
+    return word_1.length == word_2.length && (!word_1.length || !memcmp(word_1.text, word_2.text, word_1.length));
+}
+
+/* The value of a word made of digits only, else 0. As with atoi, a value too large
+ * for a long is taken as LONG_MAX before its conversion to int. */
+static int word_value(word word) {
+    long value = 0;
+    for (int i = 0; i < word.length; ++i)
+        if (!isdigit((unsigned char) word.text[i]))
+            return 0;
+    for (int i = 0; i < word.length; ++i) {
+        int digit = word.text[i] - '0';
+        if (value > (LONG_MAX - digit) / 10)
+            return (int) LONG_MAX;
+        value = value * 10 + digit;
+    }
+    return (int) value;
+}
+
+static bool permitted_variable_name(word variable_name) {
+    COUNT(TYPES_NAME_CHECKS);
+    /* Check list of reserved words. */
+    for (int illegal_var_nb = 0; illegal_var_nb < NB_ILLEGAL_VARIABLES; ++illegal_var_nb) {
+        if (word_is(variable_name, illegal_variables[illegal_var_nb]))
             return false;
-        /* Can't have more than one of long, short, longlong. */
-        if ((basic_phrase_type & SHORT) && ((basic_phrase_type & LONG) || (basic_phrase_type & LONGLONG)))
+    }
+    /* Cannot be empty or begin with a digit. */
+    if (!variable_name.length || isdigit((unsigned char) *variable_name.text))
+        return false;
+    /* Can only have alphanumeric characters or underscores. */
+    for (int i = 0; i < variable_name.length; ++i)
+        if (!isalnum((unsigned char) variable_name.text[i]) && variable_name.text[i] != '_')
             return false;
-        if ((basic_phrase_type & LONG) && ((basic_phrase_type & SHORT) || (basic_phrase_type & LONGLONG)))
+    return true;
+}
+
+/* The C basic type of the words of a basic phrase, of which only the last can be other than a
+ * basic word and is then left out, else 0. A second long makes a long long. */
+static int read_basic_phrase(types_context *ctx, int basic_start, int basic_end) {
+    int bits = 0;
+    for (int word_nb = basic_start; word_nb <= basic_end; ++word_nb) {
+        int bit = specifier_bit(ctx->words[word_nb]);
+        if (!bit && word_nb != basic_end)
+            return 0;
+        if (bit == LONG && (bits & LONG)) {
+            bits ^= LONG;
+            bit = LONGLONG;
+        }
+        if (bits & bit)
+            return 0;
+        bits |= bit;
+    }
+    return c_types[bits];
+}
+
+/* The bit value of a basic word, else 0. */
+static int specifier_bit(word word) {
+    if (word.length > MAX_SPECIFIER_LENGTH || !word.length || *word.text < 'a' || *word.text > 'z')
+        return 0;
+    const specifier *candidate = &specifiers[word.length][*word.text - 'a'];
+    COUNT(TYPES_KEYWORD_COMPARISONS);
+    return candidate->text && !memcmp(word.text, candidate->text, word.length) ? candidate->bit : 0;
+}
+
+/* Add a word to the input, a final full stop ending the phrase. */
+static bool add_word(types_context *ctx, const char *text, int length) {
+    if (length && text[length - 1] == '.') {
+        if (!grow_phrase_table(ctx, ctx->max_phrase_index + 2))
             return false;
-        if ((basic_phrase_type & LONGLONG) && ((basic_phrase_type & SHORT) || (basic_phrase_type & LONG)))
-            return false;        
+        int phrase_nb = ++ctx->max_phrase_index;
+        ctx->phrase_start[phrase_nb] = phrase_nb ? ctx->phrase_end[phrase_nb - 1] + 1 : 0;
+        ctx->phrase_end[phrase_nb] = ctx->nb_words;
+        --length;
+    }
+    return append_word(ctx, text, length);
+}
+
+/* Add a word after the last one, whether or not it ends a phrase. */
+static bool append_word(types_context *ctx, const char *text, int length) {
+    bool ok = true;
+    if (ctx->nb_words == ctx->words_size) {
+        ctx->words_size = ctx->words_size ? 2 * ctx->words_size : MIN_WORDS;
+        ctx->words = (word *) reallocate(ctx->words, ctx->words_size * sizeof(word), &ok);
     }
+    if (!ok)
+        return false;
+    ctx->words[ctx->nb_words].text = text;
+    ctx->words[ctx->nb_words++].length = length;
+    return true;
+}
+
+/* Make room in the phrase table for at least the given number of phrases, keeping their entries.
+ * The table is doubled in size as phrases are added, and kept for the next phrase set. Its arrays
+ * are placed in the order the passes use them, each on its own cache lines: the words of each
+ * phrase and what the first pass finds in it, then the references between phrases, the
+ * declarator trees of the second pass and the types. The name index has two slots per phrase. */
+static bool grow_phrase_table(types_context *ctx, int nb_phrases) {
+    if (nb_phrases <= ctx->phrases_size)
+        return true;
+    int size = ctx->phrases_size ? 2 * ctx->phrases_size : MIN_PHRASES;
+    while (size < nb_phrases)
+        size *= 2;
+    size_t entry_size = 10 * sizeof(int) + 2 * sizeof(word) + 2 * sizeof(declarator *);
+    void *table;
+    if (posix_memalign(&table, CACHE_LINE, size * entry_size + 13 * CACHE_LINE))
+        return false;
     
-    if (basic_phrase_type & CHAR) {
-        if (basic_phrase_type & (INT + DOUBLE + FLOAT + SHORT + LONG + LONGLONG))
-            return false;
-        if ((basic_phrase_type & SIGNED) && (basic_phrase_type & UNSIGNED))
+    char *new_table = (char *) table;
+    size_t offset = 0;
+    int old_size = ctx->phrases_size;
+    ctx->phrase_start = (int *) place_array(new_table, &offset, ctx->phrase_start, sizeof(int), old_size, size);
+    ctx->phrase_end = (int *) place_array(new_table, &offset, ctx->phrase_end, sizeof(int), old_size, size);
+    ctx->stage = (int *) place_array(new_table, &offset, ctx->stage, sizeof(int), old_size, size);
+    ctx->type = (int *) place_array(new_table, &offset, ctx->type, sizeof(int), old_size, size);
+    ctx->var_name = (word *) place_array(new_table, &offset, ctx->var_name, sizeof(word), old_size, size);
+    ctx->reference = (word *) place_array(new_table, &offset, ctx->reference, sizeof(word), old_size, size);
+    ctx->continuation = (int *) place_array(new_table, &offset, ctx->continuation, sizeof(int), old_size, size);
+    ctx->chain = (int *) place_array(new_table, &offset, ctx->chain, sizeof(int), old_size, size);
+    ctx->root = (declarator **) place_array(new_table, &offset, ctx->root, sizeof(declarator *), old_size, size);
+    ctx->reference_node = (declarator **) place_array(new_table, &offset, ctx->reference_node,
+                                                      sizeof(declarator *), old_size, size);
+    ctx->type_id = (int *) place_array(new_table, &offset, ctx->type_id, sizeof(int), old_size, size);
+    ctx->type_phrase = (int *) place_array(new_table, &offset, NULL, sizeof(int), 0, size);
+    ctx->name_index = (int *) place_array(new_table, &offset, NULL, 2 * sizeof(int), 0, size);
+    ctx->name_index_size = 2 * size;
+    
+    free(ctx->phrase_table);
+    ctx->phrase_table = new_table;
+    ctx->phrases_size = size;
+    return true;
+}
+
+/* Place an array of the given number of entries at the offset in the phrase table, copying the
+ * entries of the old array, and move the offset on to the next cache line after it. */
+static void *place_array(char *table, size_t *offset, const void *old_array, size_t entry_size,
+                         int nb_old_entries, int nb_entries) {
+    void *array = table + *offset;
+    if (nb_old_entries)
+        memcpy(array, old_array, nb_old_entries * entry_size);
+    *offset += (nb_entries * entry_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    return array;
+}
+
+/* Words are separated by white space in the input buffer. */
+static bool words_from_buffer(types_context *ctx, const char *buffer, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        while (i < size && isspace((unsigned char) buffer[i]))
+            ++i;
+        size_t word_start = i;
+        while (i < size && !isspace((unsigned char) buffer[i]))
+            ++i;
+        if (i > word_start && !add_word(ctx, buffer + word_start, i - word_start))
             return false;
     }
+    return true;
+}
+
+/* Reallocate an array, keeping it and setting ok to false if out of memory. */
+static void *reallocate(void *array, size_t size, bool *ok) {
+    void *new_array = realloc(array, size);
+    if (!new_array) {
+        *ok = false;
+        return array;
+    }
+    return new_array;
+}
+
+/* FNV-1a hash of a variable name. */
+static unsigned hash_name(word name) {
+    unsigned hash = 2166136261u;
+    for (int i = 0; i < name.length; ++i) {
+        hash ^= (unsigned char) name.text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Insert every named phrase into the name index, using linear probing. Each name has one slot,
+ * holding the phrase declaring it, or marked with DECLARED_AGAIN when another phrase declares it
+ * too so that find_variable can detect it. */
+static void index_variable_names(types_context *ctx) {
+    for (int i = 0; i < ctx->name_index_size; ++i)
+        ctx->name_index[i] = NO_DATA;
+    for (int phrase = 0; phrase <= ctx->max_phrase_index; ++phrase) {
+        if (!ctx->var_name[phrase].text)
+            continue;
+        int *entry = &ctx->name_index[find_name_slot(ctx, ctx->var_name[phrase])];
+        if (*entry == NO_DATA)
+            *entry = phrase;
+        else if (*entry >= 0)
+            *entry = DECLARED_AGAIN(*entry);
+    }
+}
+
+/* Return the slot of the name index holding the name, else the empty slot where it would go. */
+static int find_name_slot(const types_context *ctx, word name) {
+    unsigned slot = hash_name(name) & (ctx->name_index_size - 1);
+    for (; ctx->name_index[slot] != NO_DATA; slot = (slot + 1) & (ctx->name_index_size - 1)) {
+        int phrase = ctx->name_index[slot] >= 0 ? ctx->name_index[slot] : DECLARED_AGAIN(ctx->name_index[slot]);
+        if (same_words(name, ctx->var_name[phrase]))
+            break;
+    }
+    return slot;
+}
+
+/* Return the index of the only phrase declaring the variable, else NO_DATA
+ * if there is no such phrase or more than one. */
+static int find_variable(types_context *ctx, word name) {
+    int entry = ctx->name_index[find_name_slot(ctx, name)];
+    return entry >= 0 ? entry : NO_DATA;
+}
+
+/* Each phrase refers to at most one other phrase, so the references form chains that
+ * either end or run into a loop. Every chain is walked once, iteratively, marking its
+ * phrases ON_PATH until it reaches the end, a RESOLVED phrase or a phrase ON_PATH,
+ * which can only be in a loop. The walk is then repeated to mark its phrases RESOLVED.
+ * Returns a phrase in a loop, else NO_DATA. */
+static int find_reference_loop(types_context *ctx) {
+    int *chain = ctx->chain;
+    for (int phrase = 0; phrase <= ctx->max_phrase_index; ++phrase) {
+        int next_variable = phrase;
+        while (next_variable != NO_DATA && chain[next_variable] == UNVISITED) {
+            chain[next_variable] = ON_PATH;
+            next_variable = ctx->continuation[next_variable];
+            COUNT(TYPES_CHAIN_STEPS);
+        }
+        if (next_variable != NO_DATA && chain[next_variable] == ON_PATH)
+            return next_variable;
+        for (next_variable = phrase; next_variable != NO_DATA && chain[next_variable] == ON_PATH;
+             next_variable = ctx->continuation[next_variable]) {
+            chain[next_variable] = RESOLVED;
+            COUNT(TYPES_CHAIN_STEPS);
+        }
+    }
+    return NO_DATA;
+}
+
+/* Add a declarator to the tree of a phrase, inside the one added before. Returns NULL
+ * if out of memory. */
+static declarator *add_declarator(phrase_task *task, int kind, word text) {
+    declarator *node = new_declarator(task->arena);
+    if (!node) {
+        task->out_of_memory = true;
+        return NULL;
+    }
+    node->kind = kind;
+    node->text = text;
+    node->next = NULL;
+    node->type_id = NO_DATA;
+    *task->hole = node;
+    task->hole = &node->next;
+    return node;
+}
+
+/* Take a declarator from the current block of an arena, moving on to the next block,
+ * or allocating one, when it is full. */
+static declarator *new_declarator(arena *arena) {
+    declarator_block *block = arena->current;
+    if (!block || block->nb_used == DECLARATOR_BLOCK) {
+        if (block && block->next)
+            block = block->next;
+        else {
+            declarator_block *new_block = (declarator_block *) malloc(sizeof(declarator_block));
+            if (!new_block)
+                return NULL;
+            new_block->next = NULL;
+            if (block)
+                block->next = new_block;
+            else
+                arena->first = new_block;
+            block = new_block;
+        }
+        block->nb_used = 0;
+        arena->current = block;
+    }
+    return &block->nodes[block->nb_used++];
+}
+
+/* Have at least one arena for each worker. */
+static bool reserve_arenas(types_context *ctx, int nb_arenas) {
+    if (nb_arenas <= ctx->nb_arenas)
+        return true;
+    arena *arenas = (arena *) realloc(ctx->arenas, nb_arenas * sizeof(arena));
+    if (!arenas)
+        return false;
+    for (int arena_nb = ctx->nb_arenas; arena_nb < nb_arenas; ++arena_nb)
+        arenas[arena_nb].first = arenas[arena_nb].current = NULL;
+    ctx->arenas = arenas;
+    ctx->nb_arenas = nb_arenas;
+    return true;
+}
+
+/* Free all the declarators of an arena at once, keeping its blocks. */
+static void reset_arena(arena *arena) {
+    arena->current = arena->first;
+    if (arena->first)
+        arena->first->nb_used = 0;
+}
+
+static void free_arena(arena *arena) {
+    while (arena->first) {
+        declarator_block *next = arena->first->next;
+        free(arena->first);
+        arena->first = next;
+    }
+}
+
+/* Put a character in a buffer of the given size if it fits, leaving room for the null. */
+static void put_char(char *buffer, int size, int position, char character) {
+    if (position < size - 1)
+        buffer[position] = character;
+}
+
+/* Put the characters of a word in a buffer as put_char does, and return the position after it. */
+static int put_word(char *buffer, int size, int position, word text) {
+    for (int i = 0; i < text.length; ++i)
+        put_char(buffer, size, position++, text.text[i]);
+    return position;
+}
+
+/* The lengths of the text that declarators put in front of a variable name and behind it, going
+ * in from a declarator to the basic type, or with follow_references false to any reference.
+ * Returns the declarator they end at. */
+static const declarator *measure_declarators(const declarator *node, bool follow_references, int *prefix_length,
+                                             int *suffix_length) {
+    bool pointed_to = false;
+    *prefix_length = *suffix_length = 0;
+    for (; node->kind != BASIC; node = node->next) {
+        if (node->kind == REFERENCE) {
+            if (!follow_references)
+                break;
+            continue;
+        }
+        if (node->kind == POINTER)
+            ++*prefix_length;
+        else {
+            *prefix_length += pointed_to;
+            *suffix_length += pointed_to + node->text.length + 2;
+        }
+        pointed_to = node->kind == POINTER;
+    }
+    return node;
+}
+
+/* Put the text of declarators around a variable name in a buffer as put_char does, going in as
+ * measure_declarators does. A pointer puts '*' in front of the declaration so far and an array
+ * or function puts its brackets behind it. As brackets bind more tightly than '*', the
+ * declaration so far is put in parentheses when an array or function is pointed to. The text in
+ * front is written backwards from front, where the name starts, and the text behind from
+ * position, where it ends. Returns the position after the text behind. */
+static int put_declarators(const declarator *node, bool follow_references, char *buffer, int size, int front,
+                           int position) {
+    bool pointed_to = false;
+    for (; node->kind != BASIC; node = node->next) {
+        if (node->kind == REFERENCE) {
+            if (!follow_references)
+                break;
+            continue;
+        }
+        if (node->kind == POINTER)
+            put_char(buffer, size, --front, '*');
+        else {
+            if (pointed_to) {
+                put_char(buffer, size, --front, '(');
+                put_char(buffer, size, position++, ')');
+            }
+            if (node->kind == ARRAY) {
+                put_char(buffer, size, position++, '[');
+                position = put_word(buffer, size, position, node->text);
+                put_char(buffer, size, position++, ']');
+            }
+            else {
+                put_char(buffer, size, position++, '(');
+                put_char(buffer, size, position++, ')');
+            }
+        }
+        pointed_to = node->kind == POINTER;
+    }
+    return position;
+}
+
+/* Write the C declaration of a phrase from its declarators, following its references, as
+ * types_declaration does when the declaration of its type has not been written. */
+static int write_full_declaration(const types_context *ctx, int phrase_nb, char *buffer, int size) {
+    int prefix_length;
+    int suffix_length;
+    word basic = measure_declarators(ctx->root[phrase_nb], true, &prefix_length, &suffix_length)->text;
+    word name = ctx->var_name[phrase_nb];
+    
+    /* A basic phrase without a variable name is only its basic type, without the space. */
+    int position = put_word(buffer, size, 0, basic);
+    if (ctx->type_nodes[ctx->type_id[phrase_nb]].kind != BASIC || name.length)
+        put_char(buffer, size, position++, ' ');
+    int front = position + prefix_length;
+    position = put_word(buffer, size, front, name);
+    position = put_declarators(ctx->root[phrase_nb], true, buffer, size, front, position);
     
-    if (basic_phrase_type & FLOAT)
-        if (basic_phrase_type & (INT + CHAR + DOUBLE + SHORT + LONG + LONGLONG + SIGNED + UNSIGNED))
+    if (size > 0)
+        buffer[position < size ? position : size - 1] = '\0';
+    return position;
+}
+
+/* Write the C declaration of the declarators of a phrase up to any reference, null terminated, as
+ * snprintf does. A reference is written as the name of the typedef of the phrase referred to, so
+ * the declarators of each phrase are written out only once however long the chains of
+ * references. With as_typedef, the declaration is the typedef of the type of the phrase. Returns
+ * the length of the whole declaration. */
+static int write_own_declaration(const types_context *ctx, int phrase_nb, bool as_typedef, char *buffer, int size) {
+    int prefix_length;
+    int suffix_length;
+    const declarator *end = measure_declarators(ctx->root[phrase_nb], false, &prefix_length, &suffix_length);
+    
+    int position = 0;
+    if (as_typedef)
+        position = put_word(buffer, size, position, (word) {"typedef ", strlen("typedef ")});
+    if (end->kind == BASIC)
+        position = put_word(buffer, size, position, end->text);
+    else
+        position = put_typedef_name(ctx, ctx->continuation[phrase_nb], buffer, size, position);
+    put_char(buffer, size, position++, ' ');
+    
+    int front = position + prefix_length;
+    if (as_typedef)
+        position = put_typedef_name(ctx, phrase_nb, buffer, size, front);
+    else
+        position = put_word(buffer, size, front, ctx->var_name[phrase_nb]);
+    position = put_declarators(ctx->root[phrase_nb], false, buffer, size, front, position);
+    
+    if (size > 0)
+        buffer[position < size ? position : size - 1] = '\0';
+    return position;
+}
+
+/* Put the name of the typedef of the type of a phrase in a buffer as put_char does: TYPEDEF_PREFIX,
+ * the variable name and any suffix of the phrase set. Returns the position after it. */
+static int put_typedef_name(const types_context *ctx, int phrase_nb, char *buffer, int size, int position) {
+    position = put_word(buffer, size, position, (word) {TYPEDEF_PREFIX, strlen(TYPEDEF_PREFIX)});
+    position = put_word(buffer, size, position, ctx->var_name[phrase_nb]);
+    if (ctx->typedef_suffix) {
+        char suffix[MAX_SUFFIX_LENGTH];
+        position = put_word(buffer, size, position,
+                            (word) {suffix, snprintf(suffix, sizeof(suffix), "_%d", ctx->typedef_suffix)});
+    }
+    return position;
+}
+
+/* Choose the suffix of the typedef names of a phrase set, so that no typedef name is a variable
+ * name. The suffix is the same for every typedef name, so they stay different from each other.
+ * There is none unless a variable is named TYPEDEF_PREFIX followed by another variable name, else
+ * it is the first of _2, _3 ... that no variable name made that way ends with. Only the variable
+ * names starting with TYPEDEF_PREFIX can take a suffix, each at most one. Returns false if out of
+ * memory. */
+static bool choose_typedef_suffix(types_context *ctx) {
+    int prefix_length = strlen(TYPEDEF_PREFIX);
+    int nb_prefixed = 0;
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb) {
+        word name = ctx->var_name[phrase_nb];
+        nb_prefixed += name.length > prefix_length && !memcmp(name.text, TYPEDEF_PREFIX, prefix_length);
+    }
+    ctx->typedef_suffix = 0;
+    if (!nb_prefixed)
+        return true;
+    
+    /* taken[0] is for no suffix, taken[n] for _n from _2 on. */
+    bool *taken = (bool *) calloc(nb_prefixed + 3, sizeof(bool));
+    if (!taken)
+        return false;
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb) {
+        word name = ctx->var_name[phrase_nb];
+        if (name.length <= prefix_length || memcmp(name.text, TYPEDEF_PREFIX, prefix_length))
+            continue;
+        word rest = {name.text + prefix_length, name.length - prefix_length};
+        if (is_variable(ctx, rest))
+            taken[0] = true;
+        int digits = 0;
+        while (digits < rest.length && isdigit((unsigned char) rest.text[rest.length - 1 - digits]))
+            ++digits;
+        if (!digits || digits + 1 >= rest.length || rest.text[rest.length - 1 - digits] != '_' ||
+            rest.text[rest.length - digits] == '0')
+            continue;
+        int suffix = word_value((word) {rest.text + rest.length - digits, digits});
+        if (suffix >= 2 && suffix <= nb_prefixed + 2 && is_variable(ctx, (word) {rest.text, rest.length - digits - 1}))
+            taken[suffix] = true;
+    }
+    if (taken[0])
+        for (ctx->typedef_suffix = 2; taken[ctx->typedef_suffix]; ++ctx->typedef_suffix)
+            ;
+    free(taken);
+    return true;
+}
+
+/* Whether a phrase declares the variable. */
+static bool is_variable(const types_context *ctx, word name) {
+    return ctx->name_index[find_name_slot(ctx, name)] != NO_DATA;
+}
+
+/* Intern the type of each phrase, then write the declaration of each distinct type of a phrase
+ * unless only typedefs are wanted. The declarations are measured, placed one after the other in
+ * type_output and written, each of them by the pool when there are enough. */
+static bool intern_phrase_types(types_context *ctx) {
+    ctx->nb_type_nodes = 0;
+    ctx->type_output_length = 0;
+    for (int i = 0; i < ctx->type_index_size; ++i)
+        ctx->type_index[i] = NO_DATA;
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb)
+        if ((ctx->type_id[phrase_nb] = intern_declarators(ctx, ctx->root[phrase_nb])) == NO_DATA)
             return false;
+    if (!ctx->write_types)
+        return true;
+    
+    /* The first phrase of each type is listed, with the length of the type set to 0 until it is
+     * measured. */
+    int nb_types = 0;
+    for (int phrase_nb = 0; phrase_nb <= ctx->max_phrase_index; ++phrase_nb) {
+        type_node *type = &ctx->type_nodes[ctx->type_id[phrase_nb]];
+        if (type->output_length == NO_DATA) {
+            type->output_length = 0;
+            ctx->type_phrase[nb_types++] = phrase_nb;
+        }
+    }
+    run_job(ctx, measure_phrase_type, nb_types);
+    for (int type_nb = 0; type_nb < nb_types; ++type_nb) {
+        type_node *type = &ctx->type_nodes[ctx->type_id[ctx->type_phrase[type_nb]]];
+        type->output = ctx->type_output_length;
+        ctx->type_output_length += type->output_length;
+    }
+    if (!reserve_type_output(ctx, 0))
+        return false;
+    run_job(ctx, put_phrase_type, nb_types);
+    return true;
+}
+
+/* Intern the type of a declarator tree from the inside out. The declarators are stacked down
+ * to the basic type or to a declarator already interned, as reached through an earlier phrase
+ * referring to the same one. A REFERENCE declarator has the type of the referenced phrase.
+ * Returns the type ID, NO_DATA if out of memory. */
+static int intern_declarators(types_context *ctx, declarator *root) {
+    int depth = 0;
+    declarator *node;
+    for (node = root; node && node->type_id == NO_DATA; node = node->next) {
+        if (depth == ctx->declarator_stack_size) {
+            int size = depth ? 2 * depth : MIN_TYPE_NODES;
+            declarator **stack = (declarator **) realloc(ctx->declarator_stack, size * sizeof(declarator *));
+            if (!stack)
+                return NO_DATA;
+            ctx->declarator_stack = stack;
+            ctx->declarator_stack_size = size;
+        }
+        ctx->declarator_stack[depth++] = node;
+    }
+    
+    int type_id = node ? node->type_id : NO_DATA;
+    while (depth) {
+        node = ctx->declarator_stack[--depth];
+        if (node->kind != REFERENCE && (type_id = intern_type(ctx, node->kind, node->text, type_id)) == NO_DATA)
+            return NO_DATA;
+        node->type_id = type_id;
+    }
+    return type_id;
+}
+
+/* Return the ID of the type of the given kind, text and next type, adding it if it is new.
+ * Returns NO_DATA if out of memory. */
+static int intern_type(types_context *ctx, int kind, word text, int next) {
+    if (2 * (ctx->nb_type_nodes + 1) > ctx->type_index_size && !grow_type_index(ctx))
+        return NO_DATA;
+    unsigned slot = hash_type(kind, text, next) & (ctx->type_index_size - 1);
+    for (; ctx->type_index[slot] != NO_DATA; slot = (slot + 1) & (ctx->type_index_size - 1)) {
+        type_node *type = &ctx->type_nodes[ctx->type_index[slot]];
+        if (type->kind == kind && type->next == next && same_words(type->text, text))
+            return ctx->type_index[slot];
+    }
     
-    if (basic_phrase_type & DOUBLE)
-        if (basic_phrase_type & (INT + CHAR + FLOAT + SHORT + LONGLONG + SIGNED + UNSIGNED))
+    if (ctx->nb_type_nodes == ctx->type_nodes_size) {
+        int size = 2 * ctx->type_nodes_size;
+        type_node *type_nodes = (type_node *) realloc(ctx->type_nodes, size * sizeof(type_node));
+        if (!type_nodes)
+            return NO_DATA;
+        ctx->type_nodes = type_nodes;
+        ctx->type_nodes_size = size;
+    }
+    type_node *type = &ctx->type_nodes[ctx->nb_type_nodes];
+    type->kind = kind;
+    type->text = text;
+    type->next = next;
+    type->output = 0;
+    type->output_length = type->name_position = NO_DATA;
+    ctx->type_index[slot] = ctx->nb_type_nodes;
+    return ctx->nb_type_nodes++;
+}
+
+/* FNV-1a hash of the kind, text and next type of a type. */
+static unsigned hash_type(int kind, word text, int next) {
+    unsigned hash = hash_name(text);
+    hash = (hash ^ (unsigned) kind) * 16777619u;
+    hash = (hash ^ (unsigned) next) * 16777619u;
+    return hash;
+}
+
+/* Double the type index, keeping it at most half full, and make room for as many type nodes. */
+static bool grow_type_index(types_context *ctx) {
+    int size = ctx->type_index_size ? 2 * ctx->type_index_size : 2 * MIN_TYPE_NODES;
+    int *type_index = (int *) malloc(size * sizeof(int));
+    if (!type_index)
+        return false;
+    if (ctx->type_nodes_size < size / 2) {
+        type_node *type_nodes = (type_node *) realloc(ctx->type_nodes, size / 2 * sizeof(type_node));
+        if (!type_nodes) {
+            free(type_index);
             return false;
+        }
+        ctx->type_nodes = type_nodes;
+        ctx->type_nodes_size = size / 2;
+    }
+    for (int i = 0; i < size; ++i)
+        type_index[i] = NO_DATA;
+    for (int type_id = 0; type_id < ctx->nb_type_nodes; ++type_id) {
+        type_node *type = &ctx->type_nodes[type_id];
+        unsigned slot = hash_type(type->kind, type->text, type->next) & (size - 1);
+        while (type_index[slot] != NO_DATA)
+            slot = (slot + 1) & (size - 1);
+        type_index[slot] = type_id;
+    }
+    free(ctx->type_index);
+    ctx->type_index = type_index;
+    ctx->type_index_size = size;
+    return true;
+}
+
+/* Measure the declaration of the type listed for the pool. */
+static void measure_phrase_type(types_context *ctx, int type_nb, int worker) {
+    (void) worker;
+    measure_type(ctx, ctx->root[ctx->type_phrase[type_nb]]);
+}
+
+/* Write the declaration of the type listed for the pool at its place in type_output. */
+static void put_phrase_type(types_context *ctx, int type_nb, int worker) {
+    (void) worker;
+    put_type(ctx, ctx->root[ctx->type_phrase[type_nb]]);
+}
+
+/* Set the length of the C declaration of the type of a declarator tree, without a variable name,
+ * and the position of the name in it: the basic type and a space in front of the text of the
+ * declarators, as put_declarators writes it. */
+static void measure_type(types_context *ctx, const declarator *root) {
+    int prefix_length;
+    int suffix_length;
+    word basic = measure_declarators(root, true, &prefix_length, &suffix_length)->text;
+    type_node *type = &ctx->type_nodes[root->type_id];
+    type->name_position = basic.length + 1 + prefix_length;
+    type->output_length = type->name_position + suffix_length;
+}
+
+/* Write the declaration of the type of a declarator tree, once measured, at its place in
+ * type_output. */
+static void put_type(types_context *ctx, const declarator *root) {
+    const type_node *type = &ctx->type_nodes[root->type_id];
+    const declarator *basic = root;
+    while (basic->kind != BASIC)
+        basic = basic->next;
+    char *output = ctx->type_output + type->output;
+    memcpy(output, basic->text.text, basic->text.length);
+    output[basic->text.length] = ' ';
+    put_declarators(root, true, output, type->output_length + 1, type->name_position, type->name_position);
+    COUNT_BY(TYPES_OUTPUT_CHARACTERS, type->output_length);
+}
+
+/* Make room in type_output for the given number of characters after those used. */
+static bool reserve_type_output(types_context *ctx, int length) {
+    if (ctx->type_output_length + length <= ctx->type_output_size)
+        return true;
+    size_t size = ctx->type_output_size ? 2 * ctx->type_output_size : MIN_OUTPUT;
+    while (ctx->type_output_length + length > size)
+        size *= 2;
+    char *type_output = (char *) realloc(ctx->type_output, size);
+    if (!type_output)
+        return false;
+    ctx->type_output = type_output;
+    ctx->type_output_size = size;
+    return true;
+}
+
+/* Write the C declaration of the type of a declarator tree at the end of type_output. */
+static bool write_type(types_context *ctx, const declarator *root) {
+    measure_type(ctx, root);
+    type_node *type = &ctx->type_nodes[root->type_id];
+    if (!reserve_type_output(ctx, type->output_length)) {
+        type->output_length = type->name_position = NO_DATA;
+        return false;
+    }
+    type->output = ctx->type_output_length;
+    ctx->type_output_length += type->output_length;
+    put_type(ctx, root);
+    return true;
+}
+
+types_document *types_document_create(void) {
+    types_document *doc = (types_document *) calloc(1, sizeof(types_document));
+    if (!doc)
+        return NULL;
+    if (!(doc->ctx = types_create()) || !reserve_arenas(doc->ctx, 1)) {
+        types_destroy(doc->ctx);
+        free(doc);
+        return NULL;
+    }
+    return doc;
+}
+
+void types_document_destroy(types_document *doc) {
+    if (!doc)
+        return;
+    for (int phrase_id = 0; phrase_id < doc->nb_phrases; ++phrase_id)
+        free(doc->phrases[phrase_id].text);
+    for (int i = 0; i < doc->nb_retired; ++i)
+        free(doc->retired[i]);
+    types_destroy(doc->ctx);
+    free(doc->phrases);
+    free(doc->changed);
+    free(doc->queue);
+    free(doc->symbols);
+    free(doc->symbol_index);
+    free(doc->retired);
+    free(doc);
+}
+
+int types_document_add(types_document *doc, const char *text, size_t size, int *phrase_id) {
+    if (!single_phrase(text, size))
+        return TYPES_NO_PHRASE;
+    if (!grow_document(doc, doc->nb_phrases + 1))
+        return TYPES_NO_MEMORY;
+    *phrase_id = doc->nb_phrases++;
+    doc->ctx->max_phrase_index = doc->nb_phrases - 1;
+    doc->phrases[*phrase_id].text = NULL;
+    doc->phrases[*phrase_id].visit = 0;
+    return change_phrase(doc, *phrase_id, text, size);
+}
+
+int types_document_update(types_document *doc, int phrase_id, const char *text, size_t size) {
+    if (phrase_id < 0 || phrase_id >= doc->nb_phrases || !doc->phrases[phrase_id].text)
+        return TYPES_NO_SUCH_PHRASE;
+    if (!single_phrase(text, size))
+        return TYPES_NO_PHRASE;
+    return change_phrase(doc, phrase_id, text, size);
+}
+
+int types_document_delete(types_document *doc, int phrase_id) {
+    if (phrase_id < 0 || phrase_id >= doc->nb_phrases || !doc->phrases[phrase_id].text)
+        return TYPES_NO_SUCH_PHRASE;
+    return change_phrase(doc, phrase_id, NULL, 0);
+}
+
+/* The errors are looked for in the order that parsing a phrase set finds them. */
+types_error types_document_error(const types_document *doc) {
+    types_error error = {TYPES_OK, NO_DATA};
+    if (!doc->nb_live)
+        error.code = TYPES_NO_PHRASE;
+    for (int phrase_id = 0; phrase_id < doc->nb_phrases && doc->nb_scan_errors && error.phrase == NO_DATA; ++phrase_id)
+        if (doc->phrases[phrase_id].text && doc->phrases[phrase_id].status != TYPES_OK &&
+            doc->phrases[phrase_id].status != TYPES_BAD_PHRASE)
+            error = (types_error) {doc->phrases[phrase_id].status, phrase_id};
+    for (int phrase_id = 0; phrase_id < doc->nb_phrases && doc->nb_unresolved && error.phrase == NO_DATA; ++phrase_id)
+        if (doc->phrases[phrase_id].text && doc->phrases[phrase_id].unresolved)
+            error = (types_error) {TYPES_UNKNOWN_VARIABLE, phrase_id};
+    for (int phrase_id = 0; phrase_id < doc->nb_phrases && doc->nb_loop_phrases && error.phrase == NO_DATA; ++phrase_id)
+        if (doc->phrases[phrase_id].text && doc->phrases[phrase_id].in_loop)
+            error = (types_error) {TYPES_REFERENCE_LOOP, phrase_id};
+    for (int phrase_id = 0; phrase_id < doc->nb_phrases && doc->nb_bad_phrases && error.phrase == NO_DATA; ++phrase_id)
+        if (doc->phrases[phrase_id].text && doc->phrases[phrase_id].status == TYPES_BAD_PHRASE)
+            error = (types_error) {TYPES_BAD_PHRASE, phrase_id};
+    return error;
+}
+
+int types_document_nb_phrases(const types_document *doc) {
+    return doc->nb_phrases;
+}
+
+int types_document_has_phrase(const types_document *doc, int phrase_id) {
+    return phrase_id >= 0 && phrase_id < doc->nb_phrases && doc->phrases[phrase_id].text;
+}
+
+/* The type of a phrase is interned when its declaration is first asked for after a change.
+ * The phrases are then all correct, so there is no loop in the references. */
+int types_document_declaration(types_document *doc, int phrase_id, char *buffer, int size) {
+    types_context *ctx = doc->ctx;
+    if (ctx->type_id[phrase_id] == NO_DATA) {
+        int type_id = intern_declarators(ctx, ctx->root[phrase_id]);
+        if (type_id == NO_DATA || (ctx->type_nodes[type_id].output_length == NO_DATA && !write_type(ctx, ctx->root[phrase_id])))
+            return NO_DATA;
+        ctx->type_id[phrase_id] = type_id;
+    }
+    return types_declaration(ctx, phrase_id, buffer, size);
+}
+
+/* Whether the text is one phrase: words separated by white space, only the last of which
+ * ends with a full stop. */
+static bool single_phrase(const char *text, size_t size) {
+    bool ended = false;
+    size_t i = 0;
+    while (i < size) {
+        while (i < size && isspace((unsigned char) text[i]))
+            ++i;
+        size_t word_start = i;
+        while (i < size && !isspace((unsigned char) text[i]))
+            ++i;
+        if (i > word_start) {
+            if (ended)
+                return false;
+            ended = text[i - 1] == '.';
+        }
+    }
+    return ended;
+}
+
+/* Make room for at least the given number of phrase IDs. */
+static bool grow_document(types_document *doc, int nb_phrases) {
+    if (nb_phrases <= doc->phrases_size)
+        return true;
+    int size = doc->phrases_size ? 2 * doc->phrases_size : MIN_PHRASES;
+    bool ok = grow_phrase_table(doc->ctx, size);
+    doc->phrases = (document_phrase *) reallocate(doc->phrases, size * sizeof(document_phrase), &ok);
+    doc->changed = (int *) reallocate(doc->changed, size * sizeof(int), &ok);
+    doc->queue = (int *) reallocate(doc->queue, size * sizeof(int), &ok);
+    if (!ok)
+        return false;
+    doc->phrases_size = size;
+    return true;
+}
+
+/* Replace the text of a phrase, NULL to delete it, then bring the document up to date. The
+ * phrases whose reference may now lead to another phrase are those referring to the variable
+ * named by the phrase before and after the change, and the phrase itself. The loop check starts
+ * from those whose reference has changed, and the types from them and the phrase itself are
+ * interned again, along with those of the phrases whose references lead to them. */
+static int change_phrase(types_document *doc, int phrase_id, const char *text, size_t size) {
+    document_phrase *phrase = &doc->phrases[phrase_id];
+    char *old_text = phrase->text;
+    int old_symbol = NO_DATA;
+    char *copy = NULL;
+    if (text) {
+        if (!(copy = (char *) malloc(size + 1)))
+            return TYPES_NO_MEMORY;
+        memcpy(copy, text, size);
+        copy[size] = '\0';
+    }
+    if (phrase->text) {
+        old_symbol = phrase->declared;
+        unload_phrase(doc, phrase_id);
+        if (!retire_text(doc, phrase->text)) {
+            free(copy);
+            return TYPES_NO_MEMORY;
+        }
+        --doc->nb_live;
+    }
+    phrase->text = copy;
     
-    return basic_phrase_type;
-}
-
-char *make_basic_output(int basic_phrase_type) {
-    if (basic_phrase_type == (CHAR + SIGNED))
-        return "signed char";
-    if (basic_phrase_type == (CHAR + UNSIGNED))
-        return "unsigned char";
-    if (basic_phrase_type == CHAR)
-        return "char";
-    if (basic_phrase_type == DOUBLE)
-        return "double";
-    if (basic_phrase_type == (DOUBLE + LONG))
-        return "long double";
-    if (basic_phrase_type == FLOAT)
-        return "float";
-    if (basic_phrase_type == (INT + LONGLONG + SIGNED))
-        return "long long";
-    if (basic_phrase_type == (INT + LONGLONG + UNSIGNED))
-        return "unsigned long long";
-    if (basic_phrase_type == (INT + LONG + SIGNED))
-        return "long";
-    if (basic_phrase_type == (INT + LONG + UNSIGNED))
-        return "unsigned long";
-    if (basic_phrase_type == (INT + SHORT + SIGNED))
-        return "short";
-    if (basic_phrase_type == (INT + SHORT + UNSIGNED))
-        return "unsigned short";
-    if (basic_phrase_type == (INT + SIGNED))
-        return "int";
-    if (basic_phrase_type == (INT + UNSIGNED))
-        return "unsigned";
-    printf("ERROR - UNKNOWN BASIC TYPE\n");
-}
-
-void resize_arrays(void) {
-    /* Allocate arrray sizes according to the number of phrases. */
-    phrase_end = (int *) realloc(phrase_end, (max_phrase_index + 1) * sizeof(int));
-    phrase_start = (int *) realloc(phrase_start, (max_phrase_index + 1) * sizeof(int));
-    var_name = (char **) realloc(var_name, (max_phrase_index + 1) * sizeof(char*));
-    reference = (char **) realloc(reference, (max_phrase_index + 1) * sizeof(char*));
-    continuation = (int *) realloc(continuation, (max_phrase_index + 1) * sizeof(int));
-    stage = (int *) realloc(stage, (max_phrase_index + 1) * sizeof(int));
-    type = (int *) realloc(type, (max_phrase_index + 1) * sizeof(int));
-    chain = (int *) realloc(chain, (max_phrase_index + 1) * sizeof(int));
-    output_start = (int *) realloc(output_start, (max_phrase_index + 1) * sizeof(int));
-    output_end = (int *) realloc(output_end, (max_phrase_index + 1) * sizeof(int));
-    phrase_output = (char **) calloc(MAX_OUTPUT, sizeof(char*));
-    for (int i = 0; i <= MAX_OUTPUT; ++i)
-        phrase_output[i] = (char *) calloc(max_phrase_index + 1, sizeof(char));
-            
-    for (int i = 0; i <= max_phrase_index; ++i) {
-        phrase_end[i] = phrase_start[i] = 0;
-        var_name[i] = reference[i] = continuation[i] = 0; 
-        stage[i] = type[i] = chain[i] = 0;
-        output_start[i] = output_end[i] = 0;        
-    }
-}
-
-void output_at_front(int phrase_nb, char *string_to_add) {
-    /* Add text to the front of the output. */
-    output_start[phrase_nb] -= strlen(string_to_add);
-    for (int i = 0; i < strlen(string_to_add); ++i) {
-        phrase_output[i + output_start[phrase_nb] + 1][phrase_nb] = string_to_add[i];
-    }
-}
-
-void output_at_back(int phrase_nb, char *string_to_add) {
-    /* Add text to the front of the output. */
-    for (int i = 0; i < strlen(string_to_add); ++i) {
-        phrase_output[i + output_end[phrase_nb]][phrase_nb] = string_to_add[i];
-    }
-    output_end[phrase_nb] += strlen(string_to_add);    
+    doc->nb_changed = 0;
+    if (copy) {
+        ++doc->nb_live;
+        int result = load_phrase(doc, phrase_id);
+        if (result != TYPES_OK)
+            return result;
+        resolve_phrase(doc, phrase_id);
+        if (!doc->nb_changed)
+            doc->changed[doc->nb_changed++] = phrase_id;
+    }
+    if (old_symbol != NO_DATA)
+        resolve_referrers(doc, old_symbol);
+    if (copy && phrase->declared != NO_DATA && phrase->declared != old_symbol)
+        resolve_referrers(doc, phrase->declared);
+    
+    find_document_loops(doc);
+    invalidate_types(doc);
+    if (old_text && ++doc->nb_edits > doc->nb_live + MIN_PHRASES)
+        return rebuild_document(doc);
+    return TYPES_OK;
 }
 
+/* Split the text of a phrase into words after the last ones, parse the phrase on its own and
+ * enter its variables in the symbol table. */
+static int load_phrase(types_document *doc, int phrase_id) {
+    types_context *ctx = doc->ctx;
+    document_phrase *phrase = &doc->phrases[phrase_id];
+    ctx->phrase_start[phrase_id] = ctx->nb_words;
+    for (const char *text = phrase->text; *text; ) {
+        while (isspace((unsigned char) *text))
+            ++text;
+        const char *word_start = text;
+        while (*text && !isspace((unsigned char) *text))
+            ++text;
+        int length = text - word_start;
+        if (length && !append_word(ctx, word_start, length - (word_start[length - 1] == '.')))
+            return TYPES_NO_MEMORY;
+    }
+    ctx->phrase_end[phrase_id] = ctx->nb_words - 1;
+    
+    phrase->declared = phrase->referred = NO_DATA;
+    phrase->unresolved = phrase->in_loop = false;
+    ctx->type_id[phrase_id] = NO_DATA;
+    phrase->status = scan_phrase(ctx, phrase_id);
+    if (phrase->status == TYPES_OK) {
+        parse_complex_phrase(ctx, phrase_id, 0);
+        if (ctx->stage[phrase_id] == OUT_OF_MEMORY)
+            return TYPES_NO_MEMORY;
+        if (ctx->stage[phrase_id] == ERROR)
+            phrase->status = TYPES_BAD_PHRASE;
+    }
+    if (phrase->status == TYPES_BAD_PHRASE)
+        ++doc->nb_bad_phrases;
+    else if (phrase->status != TYPES_OK)
+        ++doc->nb_scan_errors;
+    
+    if (ctx->var_name[phrase_id].text) {
+        if ((phrase->declared = find_symbol(doc, ctx->var_name[phrase_id])) == NO_DATA)
+            return TYPES_NO_MEMORY;
+        symbol *declared = &doc->symbols[phrase->declared];
+        link_phrase(doc, &declared->first_declarer, phrase_id, true);
+        ++declared->nb_declarers;
+    }
+    if (ctx->reference[phrase_id].text) {
+        if ((phrase->referred = find_symbol(doc, ctx->reference[phrase_id])) == NO_DATA)
+            return TYPES_NO_MEMORY;
+        link_phrase(doc, &doc->symbols[phrase->referred].first_referrer, phrase_id, false);
+    }
+    return TYPES_OK;
+}
+
+/* Take a phrase out of the symbol table, the error counts and any loop. */
+static void unload_phrase(types_document *doc, int phrase_id) {
+    document_phrase *phrase = &doc->phrases[phrase_id];
+    if (phrase->declared != NO_DATA) {
+        symbol *declared = &doc->symbols[phrase->declared];
+        unlink_phrase(doc, &declared->first_declarer, phrase_id, true);
+        --declared->nb_declarers;
+    }
+    if (phrase->referred != NO_DATA)
+        unlink_phrase(doc, &doc->symbols[phrase->referred].first_referrer, phrase_id, false);
+    if (phrase->status == TYPES_BAD_PHRASE)
+        --doc->nb_bad_phrases;
+    else if (phrase->status != TYPES_OK)
+        --doc->nb_scan_errors;
+    if (phrase->unresolved)
+        --doc->nb_unresolved;
+    if (phrase->in_loop)
+        break_loop(doc, phrase_id);
+    phrase->declared = phrase->referred = NO_DATA;
+    phrase->unresolved = false;
+    doc->ctx->continuation[phrase_id] = NO_DATA;
+}
+
+/* Set the phrase that a phrase refers to, from the phrases naming its referenced variable. A
+ * loop through the phrase is broken first, and a phrase whose reference changes is recorded. */
+static void resolve_phrase(types_document *doc, int phrase_id) {
+    types_context *ctx = doc->ctx;
+    document_phrase *phrase = &doc->phrases[phrase_id];
+    int continuation = NO_DATA;
+    bool unresolved = false;
+    if (phrase->referred != NO_DATA) {
+        symbol *referred = &doc->symbols[phrase->referred];
+        unresolved = referred->nb_declarers != 1;
+        if (!unresolved)
+            continuation = referred->first_declarer;
+    }
+    doc->nb_unresolved += unresolved - phrase->unresolved;
+    phrase->unresolved = unresolved;
+    if (continuation == ctx->continuation[phrase_id])
+        return;
+    if (phrase->in_loop)
+        break_loop(doc, phrase_id);
+    ctx->continuation[phrase_id] = continuation;
+    doc->changed[doc->nb_changed++] = phrase_id;
+}
+
+static void resolve_referrers(types_document *doc, int symbol_nb) {
+    for (int referrer = doc->symbols[symbol_nb].first_referrer; referrer != NO_DATA;
+         referrer = doc->phrases[referrer].next_referrer)
+        resolve_phrase(doc, referrer);
+}
+
+/* Clear the loop that a phrase is in. */
+static void break_loop(types_document *doc, int phrase_id) {
+    int link = phrase_id;
+    do {
+        doc->phrases[link].in_loop = false;
+        --doc->nb_loop_phrases;
+        link = doc->ctx->continuation[link];
+    } while (link != phrase_id);
+}
+
+/* A new loop goes through a phrase whose reference has changed. The references are followed
+ * from each of them until they end, reach a loop or reach a phrase visited from an earlier one,
+ * whose references have then been followed already. A phrase visited twice from the same one is
+ * in a new loop. */
+static void find_document_loops(types_document *doc) {
+    int first_walk = doc->walk;
+    for (int i = 0; i < doc->nb_changed; ++i) {
+        int walk = ++doc->walk;
+        int link = doc->changed[i];
+        while (link != NO_DATA && !doc->phrases[link].in_loop && doc->phrases[link].visit <= first_walk) {
+            doc->phrases[link].visit = walk;
+            link = doc->ctx->continuation[link];
+        }
+        if (link == NO_DATA || doc->phrases[link].in_loop || doc->phrases[link].visit != walk)
+            continue;
+        int loop_phrase = link;
+        do {
+            doc->phrases[link].in_loop = true;
+            ++doc->nb_loop_phrases;
+            link = doc->ctx->continuation[link];
+        } while (link != loop_phrase);
+    }
+}
+
+/* Forget the types of the changed phrases and of every phrase whose references lead to one of
+ * them, found by following the references backwards, and link their trees to the trees of the
+ * phrases they now refer to. */
+static void invalidate_types(types_document *doc) {
+    types_context *ctx = doc->ctx;
+    int walk = ++doc->walk;
+    int nb_queued = 0;
+    for (int i = 0; i < doc->nb_changed; ++i)
+        if (doc->phrases[doc->changed[i]].visit != walk) {
+            doc->phrases[doc->changed[i]].visit = walk;
+            doc->queue[nb_queued++] = doc->changed[i];
+        }
+    for (int next = 0; next < nb_queued; ++next) {
+        int phrase_id = doc->queue[next];
+        ctx->type_id[phrase_id] = NO_DATA;
+        for (declarator *node = ctx->root[phrase_id]; node; node = node->kind == REFERENCE ? NULL : node->next)
+            node->type_id = NO_DATA;
+        if (ctx->reference_node[phrase_id])
+            ctx->reference_node[phrase_id]->next =
+                ctx->continuation[phrase_id] == NO_DATA ? NULL : ctx->root[ctx->continuation[phrase_id]];
+        
+        int declared = doc->phrases[phrase_id].declared;
+        if (declared == NO_DATA || doc->symbols[declared].nb_declarers != 1)
+            continue;
+        for (int referrer = doc->symbols[declared].first_referrer; referrer != NO_DATA;
+             referrer = doc->phrases[referrer].next_referrer)
+            if (doc->phrases[referrer].visit != walk && ctx->continuation[referrer] == phrase_id) {
+                doc->phrases[referrer].visit = walk;
+                doc->queue[nb_queued++] = referrer;
+            }
+    }
+}
+
+/* Parse the whole document again, once the words, declarators, types and texts left by earlier
+ * changes outnumber those in use. */
+static int rebuild_document(types_document *doc) {
+    types_context *ctx = doc->ctx;
+    ctx->nb_words = 0;
+    reset_arena(&ctx->arenas[0]);
+    ctx->nb_type_nodes = 0;
+    ctx->type_output_length = 0;
+    for (int i = 0; i < ctx->type_index_size; ++i)
+        ctx->type_index[i] = NO_DATA;
+    for (int i = 0; i < doc->nb_retired; ++i)
+        free(doc->retired[i]);
+    doc->nb_retired = 0;
+    doc->nb_symbols = 0;
+    for (int i = 0; i < doc->symbol_index_size; ++i)
+        doc->symbol_index[i] = NO_DATA;
+    doc->nb_scan_errors = doc->nb_bad_phrases = doc->nb_unresolved = doc->nb_loop_phrases = 0;
+    doc->nb_edits = 0;
+    
+    doc->nb_changed = 0;
+    for (int phrase_id = 0; phrase_id < doc->nb_phrases; ++phrase_id)
+        if (doc->phrases[phrase_id].text) {
+            ctx->continuation[phrase_id] = NO_DATA;
+            int result = load_phrase(doc, phrase_id);
+            if (result != TYPES_OK)
+                return result;
+        }
+    for (int phrase_id = 0; phrase_id < doc->nb_phrases; ++phrase_id)
+        if (doc->phrases[phrase_id].text)
+            resolve_phrase(doc, phrase_id);
+    find_document_loops(doc);
+    invalidate_types(doc);
+    return TYPES_OK;
+}
+
+/* Return the symbol of a variable name, adding it if it is new. Returns NO_DATA if out of memory. */
+static int find_symbol(types_document *doc, word name) {
+    if (2 * (doc->nb_symbols + 1) > doc->symbol_index_size && !grow_symbol_index(doc))
+        return NO_DATA;
+    unsigned slot = hash_name(name) & (doc->symbol_index_size - 1);
+    for (; doc->symbol_index[slot] != NO_DATA; slot = (slot + 1) & (doc->symbol_index_size - 1))
+        if (same_words(doc->symbols[doc->symbol_index[slot]].name, name))
+            return doc->symbol_index[slot];
+    symbol *new_symbol = &doc->symbols[doc->nb_symbols];
+    new_symbol->name = name;
+    new_symbol->nb_declarers = 0;
+    new_symbol->first_declarer = new_symbol->first_referrer = NO_DATA;
+    doc->symbol_index[slot] = doc->nb_symbols;
+    return doc->nb_symbols++;
+}
+
+/* Double the symbol index, keeping it at most half full, and make room for as many symbols. */
+static bool grow_symbol_index(types_document *doc) {
+    int size = doc->symbol_index_size ? 2 * doc->symbol_index_size : 2 * MIN_PHRASES;
+    int *symbol_index = (int *) malloc(size * sizeof(int));
+    symbol *symbols = (symbol *) realloc(doc->symbols, size / 2 * sizeof(symbol));
+    if (!symbol_index || !symbols) {
+        free(symbol_index);
+        if (symbols)
+            doc->symbols = symbols;
+        return false;
+    }
+    doc->symbols = symbols;
+    for (int i = 0; i < size; ++i)
+        symbol_index[i] = NO_DATA;
+    for (int symbol_nb = 0; symbol_nb < doc->nb_symbols; ++symbol_nb) {
+        unsigned slot = hash_name(symbols[symbol_nb].name) & (size - 1);
+        while (symbol_index[slot] != NO_DATA)
+            slot = (slot + 1) & (size - 1);
+        symbol_index[slot] = symbol_nb;
+    }
+    free(doc->symbol_index);
+    doc->symbol_index = symbol_index;
+    doc->symbol_index_size = size;
+    return true;
+}
+
+/* Put a phrase at the head of the list of the phrases declaring, or else referring to, a symbol. */
+static void link_phrase(types_document *doc, int *first, int phrase_id, bool declarer) {
+    document_phrase *phrase = &doc->phrases[phrase_id];
+    int *next = declarer ? &phrase->next_declarer : &phrase->next_referrer;
+    int *previous = declarer ? &phrase->previous_declarer : &phrase->previous_referrer;
+    *next = *first;
+    *previous = NO_DATA;
+    if (*first != NO_DATA) {
+        if (declarer)
+            doc->phrases[*first].previous_declarer = phrase_id;
+        else
+            doc->phrases[*first].previous_referrer = phrase_id;
+    }
+    *first = phrase_id;
+}
+
+static void unlink_phrase(types_document *doc, int *first, int phrase_id, bool declarer) {
+    document_phrase *phrase = &doc->phrases[phrase_id];
+    int next = declarer ? phrase->next_declarer : phrase->next_referrer;
+    int previous = declarer ? phrase->previous_declarer : phrase->previous_referrer;
+    if (previous == NO_DATA)
+        *first = next;
+    else if (declarer)
+        doc->phrases[previous].next_declarer = next;
+    else
+        doc->phrases[previous].next_referrer = next;
+    if (next != NO_DATA) {
+        if (declarer)
+            doc->phrases[next].previous_declarer = previous;
+        else
+            doc->phrases[next].previous_referrer = previous;
+    }
+}
+
+/* Keep the text of a changed phrase until the next rebuild, as types and symbols may point into it. */
+static bool retire_text(types_document *doc, char *text) {
+    if (doc->nb_retired == doc->retired_size) {
+        int size = doc->retired_size ? 2 * doc->retired_size : MIN_PHRASES;
+        char **retired = (char **) realloc(doc->retired, size * sizeof(char *));
+        if (!retired)
+            return false;
+        doc->retired = retired;
+        doc->retired_size = size;
+    }
+    doc->retired[doc->nb_retired++] = text;
+    return true;
+}
@@ -0,0 +1,136 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:  The interface to the parser of descriptions of C types in     *
+ * types.c, for use by programs other than its command line interface. All the *
+ * state of the parser is kept in a context that the caller creates and owns,  *
+ * so contexts can be used from different threads at once. A context keeps its *
+ * allocations from one phrase set to the next. Compile types.c with           *
+ * TYPES_NO_MAIN defined to leave out its main function.                       *
+ *                                                                             *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef TYPES_H
+#define TYPES_H
+
+#include <stddef.h>
+
+/* The result of parsing a phrase set is one of the following ... */
+#define TYPES_OK 0
+#define TYPES_NO_PHRASE 1  // No phrase, or the last word does not end with a full stop.
+#define TYPES_SHORT_PHRASE 2  // A phrase has too few words to describe its type.
+#define TYPES_BAD_ARTICLE 3  // A phrase does not start with 'A' or 'An' as appropriate.
+#define TYPES_BAD_PHRASE 4  // A phrase does not describe a type.
+#define TYPES_UNKNOWN_VARIABLE 5  // A referenced variable is not named by exactly one phrase.
+#define TYPES_REFERENCE_LOOP 6  // Variable references make a loop.
+#define TYPES_NO_MEMORY 7
+#define TYPES_NO_SUCH_PHRASE 8  // No phrase of a document has the ID.
+
+typedef struct types_context types_context;
+
+typedef struct {
+    int code;  // One of the results above.
+    int phrase;  // The index (from 0) of the phrase in error, else -1.
+} types_error;
+
+/* Create and destroy a context, NULL if out of memory. */
+types_context *types_create(void);
+void types_destroy(types_context *);
+
+/* Parse a phrase set given as words, as on a command line, or as text with words separated by
+ * white space. The last word of each phrase ends with a full stop. The words or text are not
+ * copied or modified and must outlive the results. Returns one of the results above. */
+int types_parse_words(types_context *, int, char **);
+int types_parse_text(types_context *, const char *, size_t);
+
+/* Share the parsing of large phrase sets between this number of threads, 1 by default. */
+void types_set_threads(types_context *, int);
+
+/* Write the declaration of each distinct type when parsing, so that types_declaration only
+ * copies it, 1 by default. With 0, when only typedefs are wanted, types_declaration writes each
+ * declaration out in full. */
+void types_set_declarations(types_context *, int);
+
+/* The error of the last phrase set parsed. */
+types_error types_last_error(const types_context *);
+
+/* The results of the last phrase set parsed without error. */
+int types_nb_phrases(const types_context *);
+
+/* Write the C declaration of a phrase, null terminated, to a buffer of the given size, as
+ * snprintf does. Returns the length of the whole declaration. */
+int types_declaration(const types_context *, int, char *, int);
+
+/* The ID of the type of a phrase. Phrases have the same type only if they have the same ID. */
+int types_type_id(const types_context *, int);
+
+/* The index of the phrase declaring the variable referenced by a phrase, else -1. */
+int types_referenced_phrase(const types_context *, int);
+
+/* Set the name of the variable of a phrase, not null terminated, and return its length. */
+int types_variable_name(const types_context *, int, const char **);
+
+/* Write declarations as types_declaration does, but with the type of a variable referred to
+ * named by a typedef of "type_of_" and the variable name, so that chains of references are not
+ * written out again for each phrase along them. If that could be the name of a variable of the
+ * phrase set, every typedef name ends with the same suffix "_2", "_3" ... that makes none one.
+ * types_typedef writes the typedef of the type of a phrase, in terms of the typedef of any
+ * phrase it refers to, and types_typedef_declaration writes the declaration of a phrase in
+ * terms of the typedef of any phrase it refers to. */
+int types_typedef(const types_context *, int, char *, int);
+int types_typedef_declaration(const types_context *, int, char *, int);
+
+#ifdef TYPES_STATS
+/* With TYPES_STATS defined when compiling types.c and its callers, the time taken by each phase
+ * of parsing the last phrase set is kept, with counts of the work done in it. */
+#define TYPES_TOKENIZE 0
+#define TYPES_FIRST_PASS 1
+#define TYPES_RESOLVE 2  // Finding the phrase declaring each referenced variable.
+#define TYPES_LOOP_CHECK 3
+#define TYPES_SECOND_PASS 4
+#define TYPES_INTERN 5  // Interning the types and writing their declarations.
+#define TYPES_NB_PHASES 6
+
+#define TYPES_KEYWORD_COMPARISONS 0  // Words compared with a keyword or reserved word.
+#define TYPES_NAME_CHECKS 1  // Words checked as variable names.
+#define TYPES_CHAIN_STEPS 2  // Steps along chains of references when checking for loops.
+#define TYPES_REFERENCES_FOLLOWED 3  // Phrases continued through a reference to another phrase.
+#define TYPES_OUTPUT_CHARACTERS 4  // Characters written in declarations of types.
+#define TYPES_NB_COUNTS 5
+
+typedef struct {
+    double seconds[TYPES_NB_PHASES];
+    long long counts[TYPES_NB_COUNTS];
+} types_stats;
+
+types_stats types_last_stats(const types_context *);
+#endif
+
+/* A document is a phrase set kept up to date as its phrases are added, changed and deleted.
+ * Only the phrases whose references lead through a changed phrase are checked and written
+ * again. Phrases are known by the ID they are given when added, in the order they were added,
+ * and their text is copied. */
+typedef struct types_document types_document;
+
+types_document *types_document_create(void);
+void types_document_destroy(types_document *);
+
+/* Add a phrase at the end of the document and set its ID, replace a phrase or delete it. The
+ * text must be a single phrase. Returns TYPES_OK, TYPES_NO_PHRASE if the text is not a single
+ * phrase, TYPES_NO_SUCH_PHRASE or TYPES_NO_MEMORY. After TYPES_NO_MEMORY the document can only
+ * be destroyed. */
+int types_document_add(types_document *, const char *, size_t, int *);
+int types_document_update(types_document *, int, const char *, size_t);
+int types_document_delete(types_document *, int);
+
+/* The error in the phrases of the document as it stands: the code that types_last_error gives
+ * for the same phrase set, with the ID of a phrase in error. */
+types_error types_document_error(const types_document *);
+
+/* The number of IDs given out, and whether a phrase with an ID has not been deleted. */
+int types_document_nb_phrases(const types_document *);
+int types_document_has_phrase(const types_document *, int);
+
+/* Write the C declaration of a phrase of a document with no error, as types_declaration does.
+ * Returns -1 if out of memory. */
+int types_document_declaration(types_document *, int, char *, int);
+
+#endif
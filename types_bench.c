@@ -0,0 +1,536 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:  A program that generates sets of phrases for types.c, with    *
+ * the C declarations expected for them, and times the phases of parsing them. *
+ * The phrases are made in groups: a chain of phrases each referring to the    *
+ * one before, the first ending in a basic type, then phrases all referring to *
+ * the last phrase of the chain. The number of phrases, the largest number of  *
+ * array, pointer and function types in a phrase, the length of the chains,    *
+ * the number of phrases referring to the end of each chain (its fan in) and   *
+ * the basic types used are set by options:                                    *
+ *                                                                             *
+ *     -n PHRASES -d DEPTH -c CHAIN -i FAN_IN -b TYPE,TYPE,... -s SEED         *
+ *                                                                             *
+ * where a basic type is written as in C with '-' for spaces, as in            *
+ * unsigned-long. The phrases are written one per line to standard output, or  *
+ * to the file given with -o, and the expected declarations to the file given  *
+ * with -e. The declarations are written here independently of types.c.        *
+ *                                                                             *
+ * With -t STEPS, the phrases are instead parsed STEPS times, from PHRASES     *
+ * phrases doubling each time, with the threads given by -j (1 by default).    *
+ * The phases of parsing are timed by types.c, as types_last_stats reports     *
+ * them, and writing out the declarations is timed here, each taking the best  *
+ * of the repetitions given by -r. The output is checked against the expected  *
+ * declarations. A line of tab separated times in milliseconds is written for  *
+ * each size, followed by the ratio of each time to that for half the phrases. *
+ * A ratio near 2 is linear and a ratio near 4 is quadratic.                   *
+ *                                                                             *
+ * The parser is used only through types.h, with its statistics, so compile    *
+ * this file with types.c, both with TYPES_STATS defined and types.c with      *
+ * TYPES_NO_MAIN defined, and with -pthread:                                   *
+ *                                                                             *
+ *     gcc -DTYPES_STATS -DTYPES_NO_MAIN -pthread types_bench.c types.c        *
+ *                                                                             *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "types.h"
+
+#ifndef TYPES_STATS
+#error "types_bench.c needs TYPES_STATS defined"
+#endif
+
+/* kind of type is one of the following ... */
+#define ARRAY 1
+#define POINTER 2
+#define FUNCTION 3
+
+#define NO_DATA -1
+#define MIN_TEXT 65536
+#define MAX_DEPTH 32
+#define NB_BASIC_TYPES 14
+#define NB_PHASES (TYPES_NB_PHASES + 1)  // The phases of types.c, then writing out the declarations.
+#define BASIC_END 0
+#define VOID_END 1
+#define REFERENCE_END 2
+
+/* A basic type as words of a phrase and as written in C. */
+typedef struct {
+    const char *words;
+    const char *declaration;
+} basic_type;
+
+static const basic_type basic_types[NB_BASIC_TYPES] = {
+    {"int", "int"}, {"char", "char"}, {"signed char", "signed char"}, {"unsigned char", "unsigned char"},
+    {"short", "short"}, {"unsigned short int", "unsigned short"}, {"long", "long"},
+    {"unsigned long", "unsigned long"}, {"long long int", "long long"},
+    {"unsigned long long", "unsigned long long"}, {"unsigned", "unsigned"}, {"float", "float"},
+    {"double", "double"}, {"long double", "long double"}};
+
+static const char *const phase_names[NB_PHASES] = {"tokenize", "first_pass", "resolve", "loop_check", "second_pass",
+                                                   "intern", "output"};
+
+/* The type of a generated phrase, from its outermost array, pointer or function type in. */
+typedef struct {
+    int depth;  // The number of array, pointer and function types.
+    int kind[MAX_DEPTH];  // ARRAY, POINTER or FUNCTION.
+    int elements[MAX_DEPTH];  // The number of elements of an ARRAY.
+    int end;  // BASIC_END, VOID_END or REFERENCE_END.
+    int basic;  // The index in basic_types of the basic type.
+    int referenced;  // The index of the referenced phrase.
+} shape;
+
+/* The options of the corpus. */
+typedef struct {
+    int nb_phrases;
+    int depth;
+    int chain;
+    int fan_in;
+    bool basic_used[NB_BASIC_TYPES];
+    int nb_basic_used;
+    unsigned seed;
+} corpus_options;
+
+/* A growing text. */
+typedef struct {
+    char *text;
+    size_t length;
+    size_t size;
+} text_buffer;
+
+/* Functions that generate phrases and their declarations. */
+static shape *generate_shapes(const corpus_options *);
+static void generate_derivations(shape *, int, int);
+static int random_basic(const corpus_options *, unsigned *);
+static bool write_phrase(text_buffer *, const shape *, int);
+static bool write_declaration(text_buffer *, const shape *, int);
+static bool reserve_text(text_buffer *, size_t);
+static bool add_text(text_buffer *, const char *, size_t);
+static bool add_string(text_buffer *, const char *);
+static bool add_name(text_buffer *, int);
+
+/* Functions that time the phases of parsing. */
+static int time_phases(const corpus_options *, int, int, int);
+static int run_phases(types_context *, const text_buffer *, text_buffer *, double *);
+static double seconds(void);
+
+static bool read_options(int, char **, corpus_options *, int *, int *, int *, char **, char **);
+static unsigned next_random(unsigned *);
+
+int main(int argc, char **argv) {
+    corpus_options options;
+    int steps = 0, nb_threads = 1, repetitions = 3;
+    char *phrase_file = NULL, *expected_file = NULL;
+    if (!read_options(argc, argv, &options, &steps, &nb_threads, &repetitions, &phrase_file, &expected_file)) {
+        fprintf(stderr, "Usage: %s [-n PHRASES] [-d DEPTH] [-c CHAIN] [-i FAN_IN] [-b TYPE,...] [-s SEED]\n"
+                "          [-o PHRASE_FILE] [-e EXPECTED_FILE] [-t STEPS [-j THREADS] [-r REPETITIONS]]\n", *argv);
+        return EXIT_FAILURE;
+    }
+    if (steps)
+        return time_phases(&options, steps, nb_threads, repetitions);
+
+    shape *shapes = generate_shapes(&options);
+    text_buffer phrases = {NULL, 0, 0}, expected = {NULL, 0, 0};
+    bool ok = shapes != NULL;
+    for (int phrase_nb = 0; ok && phrase_nb < options.nb_phrases; ++phrase_nb)
+        ok = write_phrase(&phrases, shapes, phrase_nb) &&
+            (!expected_file || write_declaration(&expected, shapes, phrase_nb));
+    free(shapes);
+    if (!ok) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *phrase_stream = phrase_file ? fopen(phrase_file, "w") : stdout;
+    FILE *expected_stream = expected_file ? fopen(expected_file, "w") : NULL;
+    if (!phrase_stream || (expected_file && !expected_stream)) {
+        perror(phrase_stream ? expected_file : phrase_file);
+        return EXIT_FAILURE;
+    }
+    fwrite(phrases.text, 1, phrases.length, phrase_stream);
+    if (expected_stream) {
+        fwrite(expected.text, 1, expected.length, expected_stream);
+        fclose(expected_stream);
+    }
+    if (phrase_file)
+        fclose(phrase_stream);
+    free(phrases.text);
+    free(expected.text);
+    return EXIT_SUCCESS;
+}
+
+static bool read_options(int argc, char **argv, corpus_options *options, int *steps, int *nb_threads,
+                         int *repetitions, char **phrase_file, char **expected_file) {
+    options->nb_phrases = 1000;
+    options->depth = 4;
+    options->chain = 2;
+    options->fan_in = 2;
+    options->seed = 1;
+    options->nb_basic_used = NB_BASIC_TYPES;
+    for (int basic = 0; basic < NB_BASIC_TYPES; ++basic)
+        options->basic_used[basic] = true;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:d:c:i:b:s:o:e:t:j:r:")) != -1) {
+        switch (option) {
+            case 'n': options->nb_phrases = atoi(optarg); break;
+            case 'd': options->depth = atoi(optarg); break;
+            case 'c': options->chain = atoi(optarg); break;
+            case 'i': options->fan_in = atoi(optarg); break;
+            case 's': options->seed = strtoul(optarg, NULL, 10); break;
+            case 'o': *phrase_file = optarg; break;
+            case 'e': *expected_file = optarg; break;
+            case 't': *steps = atoi(optarg); break;
+            case 'j': *nb_threads = atoi(optarg); break;
+            case 'r': *repetitions = atoi(optarg); break;
+            case 'b': {
+                options->nb_basic_used = 0;
+                for (int basic = 0; basic < NB_BASIC_TYPES; ++basic)
+                    options->basic_used[basic] = false;
+                for (char *name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+                    for (char *dash = strchr(name, '-'); dash; dash = strchr(dash, '-'))
+                        *dash = ' ';
+                    int basic = 0;
+                    while (basic < NB_BASIC_TYPES && strcmp(name, basic_types[basic].declaration))
+                        ++basic;
+                    if (basic == NB_BASIC_TYPES)
+                        return false;
+                    options->nb_basic_used += !options->basic_used[basic];
+                    options->basic_used[basic] = true;
+                }
+                break;
+            }
+            default: return false;
+        }
+    }
+    return optind == argc && options->nb_phrases > 0 && options->depth > 0 && options->depth <= MAX_DEPTH &&
+        options->chain >= 0 && options->fan_in >= 0 && options->nb_basic_used && *steps >= 0 &&
+        *nb_threads > 0 && *repetitions > 0;
+}
+
+/* Make the phrases in groups of a chain of chain + 1 phrases followed by fan_in phrases
+ * referring to the end of the chain. The phrases of a group are spread over the phrase set. */
+static shape *generate_shapes(const corpus_options *options) {
+    int nb_phrases = options->nb_phrases;
+    shape *shapes = (shape *) malloc(nb_phrases * sizeof(shape));
+    int *order = (int *) malloc(nb_phrases * sizeof(int));
+    if (!shapes || !order) {
+        free(shapes);
+        free(order);
+        return NULL;
+    }
+
+    /* Shuffle the phrase indices, the groups taking them in that order. */
+    unsigned state = options->seed;
+    for (int i = 0; i < nb_phrases; ++i)
+        order[i] = i;
+    for (int i = nb_phrases - 1; i > 0; --i) {
+        int j = next_random(&state) % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    int group_size = options->chain + 1 + options->fan_in;
+    for (int i = 0; i < nb_phrases; ++i) {
+        shape *phrase = &shapes[order[i]];
+        int position = i % group_size;
+
+        /* The first phrase of a chain can be basic; all others are complex to refer to another. */
+        if (!position) {
+            int depth = next_random(&state) % (options->depth + 1);
+            generate_derivations(phrase, depth, next_random(&state));
+            phrase->end = depth && phrase->kind[depth - 1] != ARRAY && !(next_random(&state) % 8) ? VOID_END : BASIC_END;
+            phrase->basic = random_basic(options, &state);
+        }
+        else {
+            generate_derivations(phrase, 1 + next_random(&state) % options->depth, next_random(&state));
+            phrase->end = REFERENCE_END;
+            phrase->referenced = order[position <= options->chain ? i - 1 : i - position + options->chain];
+        }
+    }
+    free(order);
+    return shapes;
+}
+
+/* Choose the array, pointer and function types of a phrase. A function can only return a
+ * pointer or a datum, and an array can only be of arrays, pointers or data. */
+static void generate_derivations(shape *phrase, int depth, int seed) {
+    unsigned state = seed;
+    phrase->depth = depth;
+    for (int i = 0; i < depth; ++i) {
+        int previous = i ? phrase->kind[i - 1] : NO_DATA;
+        int kind;
+        do
+            kind = 1 + next_random(&state) % 3;
+        while ((previous == FUNCTION && kind != POINTER) || (previous == ARRAY && kind == FUNCTION));
+        phrase->kind[i] = kind;
+        phrase->elements[i] = next_random(&state) % 4 ? 1 + next_random(&state) % 12 : 1;
+    }
+}
+
+static int random_basic(const corpus_options *options, unsigned *state) {
+    int choice = next_random(state) % options->nb_basic_used;
+    for (int basic = 0; basic < NB_BASIC_TYPES; ++basic)
+        if (options->basic_used[basic] && !choice--)
+            return basic;
+    return 0;
+}
+
+/* Write a phrase on a line, naming its variable vN for the phrase N. The noun after an array
+ * of more than one element or after pointers is plural, and a singular noun after a pointer
+ * or function has an article. */
+static bool write_phrase(text_buffer *buffer, const shape *shapes, int phrase_nb) {
+    const shape *phrase = &shapes[phrase_nb];
+    bool ok = true;
+    if (!phrase->depth) {
+        const char *words = basic_types[phrase->basic].words;
+        ok = add_string(buffer, strchr("aeiou", *words) ? "An " : "A ") && add_string(buffer, words) &&
+            add_string(buffer, " ") && add_name(buffer, phrase_nb) && add_string(buffer, ".\n");
+        return ok;
+    }
+
+    static const char *const first_words[] = {NULL, "An array ", "A pointer ", "A function "};
+    static const char *const singular_nouns[] = {"datum", "array", "pointer", "function"};
+    static const char *const plural_nouns[] = {"data", "arrays", "pointers", "functions"};
+    ok = add_string(buffer, first_words[phrase->kind[0]]) && add_name(buffer, phrase_nb);
+    bool plural = false;
+    for (int i = 0; ok && i <= phrase->depth; ++i) {
+        int previous = i ? phrase->kind[i - 1] : NO_DATA;
+        char number[16];
+        if (previous == ARRAY) {
+            snprintf(number, sizeof(number), " of %d ", phrase->elements[i - 1]);
+            ok = add_string(buffer, number);
+            plural = phrase->elements[i - 1] > 1;
+        }
+        else if (previous == POINTER)
+            ok = add_string(buffer, " to ");
+        else if (previous == FUNCTION) {
+            ok = add_string(buffer, " returning ");
+            plural = false;
+        }
+        if (!ok)
+            break;
+
+        if (i < phrase->depth) {
+            if (!i)
+                continue;
+            int kind = phrase->kind[i];
+            if (previous != ARRAY && !plural)
+                ok = add_string(buffer, kind == ARRAY ? "an " : "a ");
+            ok = ok && add_string(buffer, plural ? plural_nouns[kind] : singular_nouns[kind]);
+        }
+        else if (phrase->end == VOID_END)
+            ok = add_string(buffer, "void");
+        else {
+            if (previous != ARRAY && !plural)
+                ok = add_string(buffer, "a ");
+            ok = ok && add_string(buffer, plural ? "data of type " : "datum of type ");
+            if (phrase->end == BASIC_END)
+                ok = ok && add_string(buffer, basic_types[phrase->basic].words);
+            else
+                ok = ok && add_string(buffer, "the type of ") && add_name(buffer, phrase->referenced);
+        }
+    }
+    return ok && add_string(buffer, ".\n");
+}
+
+/* Write the declaration of a phrase on a line, following its references to the basic type.
+ * Going in from the outermost type, a pointer goes in front of the declaration so far, and an
+ * array or function behind it, with parentheses around the declaration so far when an array or
+ * function is pointed to. */
+static bool write_declaration(text_buffer *buffer, const shape *shapes, int phrase_nb) {
+    /* The length in front of the name, and the basic type. */
+    int prefix_length = 0;
+    const shape *phrase;
+    bool pointed_to = false;
+    for (phrase = &shapes[phrase_nb]; ; phrase = &shapes[phrase->referenced]) {
+        for (int i = 0; i < phrase->depth; ++i) {
+            prefix_length += phrase->kind[i] == POINTER || pointed_to;
+            pointed_to = phrase->kind[i] == POINTER;
+        }
+        if (phrase->end != REFERENCE_END)
+            break;
+    }
+    if (!add_string(buffer, phrase->end == VOID_END ? "void" : basic_types[phrase->basic].declaration) ||
+        !add_string(buffer, " "))
+        return false;
+
+    size_t front = buffer->length + prefix_length;
+    for (int i = 0; i < prefix_length; ++i)
+        if (!add_string(buffer, " "))
+            return false;
+    if (!add_name(buffer, phrase_nb))
+        return false;
+    pointed_to = false;
+    for (phrase = &shapes[phrase_nb]; ; phrase = &shapes[phrase->referenced]) {
+        for (int i = 0; i < phrase->depth; ++i) {
+            char brackets[16];
+            if (phrase->kind[i] == POINTER)
+                buffer->text[--front] = '*';
+            else {
+                if (pointed_to) {
+                    buffer->text[--front] = '(';
+                    if (!add_string(buffer, ")"))
+                        return false;
+                }
+                if (phrase->kind[i] == ARRAY)
+                    snprintf(brackets, sizeof(brackets), "[%d]", phrase->elements[i]);
+                else
+                    strcpy(brackets, "()");
+                if (!add_string(buffer, brackets))
+                    return false;
+            }
+            pointed_to = phrase->kind[i] == POINTER;
+        }
+        if (phrase->end != REFERENCE_END)
+            break;
+    }
+    return add_string(buffer, "\n");
+}
+
+/* Make room for length more characters. */
+static bool reserve_text(text_buffer *buffer, size_t length) {
+    if (buffer->length + length > buffer->size) {
+        size_t size = buffer->size ? 2 * buffer->size : MIN_TEXT;
+        while (buffer->length + length > size)
+            size *= 2;
+        char *new_text = (char *) realloc(buffer->text, size);
+        if (!new_text)
+            return false;
+        buffer->text = new_text;
+        buffer->size = size;
+    }
+    return true;
+}
+
+static bool add_text(text_buffer *buffer, const char *text, size_t length) {
+    if (!reserve_text(buffer, length))
+        return false;
+    if (length)
+        memcpy(buffer->text + buffer->length, text, length);
+    buffer->length += length;
+    return true;
+}
+
+static bool add_string(text_buffer *buffer, const char *string) {
+    return add_text(buffer, string, strlen(string));
+}
+
+static bool add_name(text_buffer *buffer, int phrase_nb) {
+    char name[16];
+    snprintf(name, sizeof(name), "v%d", phrase_nb);
+    return add_string(buffer, name);
+}
+
+/* Time the phases for phrase sets doubling in size. Returns the exit status. */
+static int time_phases(const corpus_options *options, int steps, int nb_threads, int repetitions) {
+    types_context *ctx = types_create();
+    if (!ctx) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    types_set_threads(ctx, nb_threads);
+    printf("phrases");
+    for (int phase = 0; phase < NB_PHASES; ++phase)
+        printf("\t%s", phase_names[phase]);
+    printf("\tcorrect\n");
+
+    corpus_options step_options = *options;
+    double previous[NB_PHASES];
+    int status = EXIT_SUCCESS;
+    for (int step = 0; step < steps && status == EXIT_SUCCESS; ++step, step_options.nb_phrases *= 2) {
+        shape *shapes = generate_shapes(&step_options);
+        text_buffer phrases = {NULL, 0, 0}, expected = {NULL, 0, 0}, output = {NULL, 0, 0};
+        bool ok = shapes != NULL;
+        for (int phrase_nb = 0; ok && phrase_nb < step_options.nb_phrases; ++phrase_nb)
+            ok = write_phrase(&phrases, shapes, phrase_nb) && write_declaration(&expected, shapes, phrase_nb);
+        free(shapes);
+
+        double best[NB_PHASES];
+        int result = ok ? TYPES_OK : TYPES_NO_MEMORY;
+        for (int repetition = 0; result == TYPES_OK && repetition < repetitions; ++repetition) {
+            double times[NB_PHASES];
+            output.length = 0;
+            result = run_phases(ctx, &phrases, &output, times);
+            for (int phase = 0; result == TYPES_OK && phase < NB_PHASES; ++phase)
+                if (!repetition || times[phase] < best[phase])
+                    best[phase] = times[phase];
+        }
+        if (result != TYPES_OK) {
+            fprintf(stderr, result == TYPES_NO_MEMORY ? "Out of memory\n" : "Incorrect input\n");
+            status = EXIT_FAILURE;
+        }
+        else {
+            bool correct = output.length == expected.length && !memcmp(output.text, expected.text, output.length);
+            printf("%d", step_options.nb_phrases);
+            for (int phase = 0; phase < NB_PHASES; ++phase)
+                printf("\t%.3f", 1000 * best[phase]);
+            printf("\t%s\n", correct ? "yes" : "no");
+            if (step) {
+                printf("ratio");
+                for (int phase = 0; phase < NB_PHASES; ++phase)
+                    printf("\t%.2f", previous[phase] > 0 ? best[phase] / previous[phase] : 0);
+                printf("\t\n");
+            }
+            for (int phase = 0; phase < NB_PHASES; ++phase)
+                previous[phase] = best[phase];
+            if (!correct)
+                status = EXIT_FAILURE;
+        }
+        free(phrases.text);
+        free(expected.text);
+        free(output.text);
+    }
+    types_destroy(ctx);
+    return status;
+}
+
+/* Parse a phrase set and write its declarations one per line, setting the time of each phase in
+ * seconds. Returns the result of parsing, or TYPES_NO_MEMORY if the declarations do not fit. */
+static int run_phases(types_context *ctx, const text_buffer *phrases, text_buffer *output, double *times) {
+    int result = types_parse_text(ctx, phrases->text, phrases->length);
+    if (result != TYPES_OK)
+        return result;
+    types_stats stats = types_last_stats(ctx);
+    for (int phase = 0; phase < TYPES_NB_PHASES; ++phase)
+        times[phase] = stats.seconds[phase];
+    
+    double start = seconds();
+    for (int phrase_nb = 0; phrase_nb < types_nb_phrases(ctx); ++phrase_nb) {
+        /* Make room for the declaration and its null, then write it over the room. */
+        int length = types_declaration(ctx, phrase_nb, NULL, 0);
+        size_t start_length = output->length;
+        if (!reserve_text(output, length + 1))
+            return TYPES_NO_MEMORY;
+        types_declaration(ctx, phrase_nb, output->text + start_length, length + 1);
+        output->length = start_length + length;
+        if (!add_text(output, "\n", 1))
+            return TYPES_NO_MEMORY;
+    }
+    times[TYPES_NB_PHASES] = seconds() - start;
+    return TYPES_OK;
+}
+
+static double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* xorshift32, never returning 0 from a state other than 0. */
+static unsigned next_random(unsigned *state) {
+    if (!*state)
+        *state = 2463534242u;
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}